@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+# Runs the benchmark suite several times and either stores the results as
+# the baseline ("check.sh save") or compares them with the stored baseline
+# ("check.sh"), failing if performance regressed.
+#
+# Settings (environment variables), in addition to those of run.sh:
+#   BENCH_RUNS         number of runs (default: 3)
+#   BENCH_BASELINE     directory baseline runs are kept in
+#                      (default: bench/baseline)
+#   BENCH_TOLERANCE    smallest change flagged, percent (default: 5)
+#
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+
+BENCH_RUNS=${BENCH_RUNS:-3}
+BENCH_BASELINE=${BENCH_BASELINE:-$ROOT/bench/baseline}
+BENCH_TOLERANCE=${BENCH_TOLERANCE:-5}
+
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/myblobfs-check.XXXXXX")
+trap 'rm -rf "$WORK"' EXIT INT TERM
+
+for i in $(seq 1 "$BENCH_RUNS")
+do
+	echo "check: run $i of $BENCH_RUNS" >&2
+	sh "$ROOT/bench/run.sh" >"$WORK/run-$i.json"
+done
+
+if [ "$1" = "save" ]
+then
+	mkdir -p "$BENCH_BASELINE"
+	rm -f "$BENCH_BASELINE"/run-*.json
+	cp "$WORK"/run-*.json "$BENCH_BASELINE"
+	echo "check: baseline saved to $BENCH_BASELINE" >&2
+	exit 0
+fi
+
+set --
+for f in "$BENCH_BASELINE"/run-*.json
+do
+	if [ ! -e "$f" ]
+	then
+		echo "check: no baseline in $BENCH_BASELINE, run \"make bench-baseline\" first" >&2
+		exit 2
+	fi
+
+	set -- "$@" -b "$f"
+done
+
+sh "$ROOT/bench/compare.sh" -t "$BENCH_TOLERANCE" "$@" "$WORK"/run-*.json
@@ -0,0 +1,173 @@
+#!/bin/sh
+#
+# MyBlobFS benchmark comparator. Compares results of one or more benchmark
+# runs (JSON printed by run.sh) with one or more baseline runs and flags
+# throughput drops and p99 latency, CPU cost or round trip increases beyond
+# a tolerance. Workload lines without any known metric are warned about.
+#
+# Usage: compare.sh [-t PERCENT] -b BASELINE [-b BASELINE ...] RUN [RUN ...]
+#
+# With several runs on either side, medians are compared, and the tolerance
+# is widened to the spread (largest minus smallest, relative to the median)
+# seen between runs of the same side, so that noisy metrics do not flag
+# regressions by chance. Exits with status 1 if there is any regression.
+#
+
+TOLERANCE=5
+BASELINES=
+
+while getopts "t:b:" opt
+do
+	case "$opt" in
+	t) TOLERANCE=$OPTARG ;;
+	b) BASELINES="$BASELINES $OPTARG" ;;
+	*) echo "Usage: $0 [-t PERCENT] -b BASELINE [-b BASELINE ...] RUN [RUN ...]" >&2; exit 2 ;;
+	esac
+done
+
+shift $((OPTIND - 1))
+
+if [ -z "$BASELINES" ] || [ $# -eq 0 ]
+then
+	echo "Usage: $0 [-t PERCENT] -b BASELINE [-b BASELINE ...] RUN [RUN ...]" >&2
+	exit 2
+fi
+
+nbase=$(echo $BASELINES | wc -w)
+
+awk -v tolerance="$TOLERANCE" -v nbase="$nbase" '
+#
+# Metrics compared, and whether higher values are better
+#
+
+BEGIN {
+	split("mb_per_s iops ops_per_s files_per_s entries_per_s", higher, " ")
+	split("p99_us cpu_us_per_op round_trips_per_1000_files", lower, " ")
+
+	for (i in higher)
+	{
+		better[higher[i]] = 1
+	}
+
+	for (i in lower)
+	{
+		better[lower[i]] = -1
+	}
+}
+
+FNR == 1 {
+	files++
+	side = files <= nbase ? "base" : "run"
+}
+
+/"workload"/ {
+	match($0, /"workload": "[^"]*"/)
+	key = substr($0, RSTART + 13, RLENGTH - 14)
+
+	if (match($0, /"op": "[^"]*"/))
+	{
+		key = key "/" substr($0, RSTART + 7, RLENGTH - 8)
+	}
+
+	found = 0
+
+	for (m in better)
+	{
+		if (match($0, "\"" m "\": [-0-9.e+]+"))
+		{
+			found = 1
+			value = substr($0, RSTART + length(m) + 4, RLENGTH - length(m) - 4) + 0
+			id = key SUBSEP m
+
+			if (!(id in seen))
+			{
+				seen[id] = 1
+				ids[++nids] = id
+			}
+
+			n = ++count[side, id]
+			values[side, id, n] = value
+		}
+	}
+
+	if (!found)
+	{
+		printf "warning: %s: no known metric for workload %s\n", FILENAME, key > "/dev/stderr"
+	}
+}
+
+#
+# Returns median of values of side for id, and sets spread to the relative
+# distance between the smallest and the largest of them, in percent
+#
+
+function median(side, id,    n, i, j, v, sorted)
+{
+	n = count[side, id]
+
+	for (i = 1; i <= n; i++)
+	{
+		v = values[side, id, i]
+
+		for (j = i - 1; j >= 1 && sorted[j] > v; j--)
+		{
+			sorted[j + 1] = sorted[j]
+		}
+
+		sorted[j + 1] = v
+	}
+
+	v = n % 2 ? sorted[(n + 1) / 2] : (sorted[n / 2] + sorted[n / 2 + 1]) / 2
+	spread = v != 0 ? (sorted[n] - sorted[1]) * 100 / v : 0
+
+	return v
+}
+
+END {
+	printf "%-28s %-26s %12s %12s %8s %7s  %s\n", "workload", "metric", "baseline",
+		"current", "change", "limit", "status"
+
+	regressions = 0
+
+	for (i = 1; i <= nids; i++)
+	{
+		id = ids[i]
+		split(id, part, SUBSEP)
+
+		if (!count["base", id] || !count["run", id])
+		{
+			printf "%-28s %-26s %12s %12s %8s %7s  %s\n", part[1], part[2], "-", "-",
+				"-", "-", count["base", id] ? "missing" : "new"
+			continue
+		}
+
+		base = median("base", id)
+		limit = spread
+		run = median("run", id)
+		limit = spread > limit ? spread : limit
+		limit = tolerance > limit ? tolerance : limit
+
+		change = base != 0 ? (run - base) * 100 / base : 0
+		worse = change * better[part[2]] < 0 ? (change < 0 ? -change : change) : 0
+
+		if (worse > limit)
+		{
+			status = "REGRESSION"
+			regressions++
+		}
+		else if (change * better[part[2]] > limit)
+		{
+			status = "improved"
+		}
+		else
+		{
+			status = "ok"
+		}
+
+		printf "%-28s %-26s %12.1f %12.1f %+7.1f%% %6.1f%%  %s\n", part[1], part[2],
+			base, run, change, limit, status
+	}
+
+	exit regressions > 0
+}
+' $BASELINES "$@"
@@ -0,0 +1,710 @@
+/**
+ * MyBlobFS benchmark driver - runs a single workload against a mounted
+ * MyBlobFS file system and prints its results as a JSON object
+ *
+ * Copyright (C) 2008, 2009 Olexandr Melnyk <me@omelnyk.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/**
+ * Size of buffer used for sequential reads
+ */
+#define SEQ_BLOCK 131072
+
+/**
+ * Size of random reads
+ */
+#define RAND_BLOCK 4096
+
+/**
+ * Mount point of the file system under test
+ */
+static char *mount_point;
+
+/**
+ * Names of the files in the root directory, in listing order
+ */
+static char **files;
+static unsigned int file_count;
+
+/**
+ * Arguments and results of a parallel reader thread
+ */
+struct reader
+{
+	/**
+	 * File to read
+	 */
+	char *path;
+
+	/**
+	 * Number of bytes read, or -1 on error
+	 */
+	long long bytes;
+};
+
+/**
+ * Returns current monotonic time in seconds
+ */
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Compares two doubles, for qsort()
+ */
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double*) a, y = *(const double*) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * Prints latency percentiles of count samples (in seconds) as JSON members,
+ * in microseconds
+ */
+static void print_latencies(double *samples, unsigned int count)
+{
+	double sum;
+	unsigned int i;
+
+	if (count == 0)
+	{
+		printf("\"count\": 0");
+		return;
+	}
+
+	qsort(samples, count, sizeof(double), compare_doubles);
+
+	sum = 0;
+	for (i = 0; i < count; i++)
+	{
+		sum += samples[i];
+	}
+
+	printf("\"count\": %u, \"mean_us\": %.1f, \"p50_us\": %.1f, \"p90_us\": %.1f, "
+		"\"p99_us\": %.1f, \"max_us\": %.1f", count, sum / count * 1e6,
+		samples[count / 2] * 1e6, samples[count * 9 / 10] * 1e6,
+		samples[count * 99 / 100] * 1e6, samples[count - 1] * 1e6);
+}
+
+/**
+ * Returns newly allocated path of name inside the mount point
+ */
+static char *make_path(const char *name)
+{
+	char *path;
+
+	path = (char*) malloc(strlen(mount_point) + strlen(name) + 2);
+	if (path == NULL)
+	{
+		perror("malloc");
+		exit(1);
+	}
+
+	sprintf(path, "%s/%s", mount_point, name);
+
+	return path;
+}
+
+/**
+ * Reads names of all files in the root directory into files
+ */
+static void list_files(void)
+{
+	DIR *dir;
+	struct dirent *entry;
+	unsigned int capacity;
+
+	dir = opendir(mount_point);
+	if (dir == NULL)
+	{
+		perror(mount_point);
+		exit(1);
+	}
+
+	capacity = 0;
+
+	while ((entry = readdir(dir)) != NULL)
+	{
+		if (entry->d_name[0] == '.')
+		{
+			continue;
+		}
+
+		if (file_count == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 1024;
+			files = (char**) realloc(files, capacity * sizeof(char*));
+
+			if (files == NULL)
+			{
+				perror("realloc");
+				exit(1);
+			}
+		}
+
+		files[file_count] = strdup(entry->d_name);
+		file_count++;
+	}
+
+	closedir(dir);
+}
+
+/**
+ * Returns sum of the counters of MyBlobFS statistics file lines matching
+ * format, which converts a word and the counter, or -1 if the file is not
+ * available
+ */
+static long long server_counter(const char *format)
+{
+	char *path, line[512], kind[64];
+	unsigned long long count;
+	long long total;
+	FILE *f;
+
+	path = make_path(".myblobfs/stats");
+	f = fopen(path, "r");
+	free(path);
+
+	if (f == NULL)
+	{
+		return -1;
+	}
+
+	total = 0;
+
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		if (sscanf(line, format, kind, &count) == 2)
+		{
+			total += count;
+		}
+	}
+
+	fclose(f);
+
+	return total;
+}
+
+/**
+ * Returns total number of queries MyBlobFS has sent to the server, or -1
+ */
+static long long server_queries(void)
+{
+	return server_counter("query %63s count %llu");
+}
+
+/**
+ * Returns CPU time MyBlobFS has used, in microseconds, or -1
+ */
+static long long server_cpu(void)
+{
+	return server_counter("cpu %63s %llu");
+}
+
+/**
+ * Reads whole file at path sequentially. Returns number of bytes read or -1
+ */
+static long long read_file(const char *path)
+{
+	char *buf;
+	long long total;
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	buf = (char*) malloc(SEQ_BLOCK);
+	if (buf == NULL)
+	{
+		close(fd);
+		return -1;
+	}
+
+	total = 0;
+	while ((n = read(fd, buf, SEQ_BLOCK)) > 0)
+	{
+		total += n;
+	}
+
+	free(buf);
+	close(fd);
+
+	return n < 0 ? -1 : total;
+}
+
+/**
+ * Sequential read of one large file
+ */
+static int bench_seq_read(const char *name)
+{
+	char *path;
+	long long bytes;
+	double start, elapsed;
+
+	path = make_path(name);
+
+	start = now();
+	bytes = read_file(path);
+	elapsed = now() - start;
+
+	free(path);
+
+	if (bytes < 0)
+	{
+		return 1;
+	}
+
+	printf("{\"workload\": \"seq_read\", \"bytes\": %lld, \"seconds\": %.6f, "
+		"\"mb_per_s\": %.2f}\n", bytes, elapsed, bytes / elapsed / 1048576);
+
+	return 0;
+}
+
+/**
+ * Random 4K reads from one large file
+ */
+static int bench_rand_read(const char *name, unsigned int count)
+{
+	char *path, buf[RAND_BLOCK];
+	struct stat st;
+	double *samples, start, total;
+	off_t offset;
+	unsigned int i;
+	int fd;
+
+	path = make_path(name);
+	fd = open(path, O_RDONLY);
+	free(path);
+
+	if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < RAND_BLOCK)
+	{
+		return 1;
+	}
+
+	samples = (double*) malloc(count * sizeof(double));
+	if (samples == NULL)
+	{
+		return 1;
+	}
+
+	total = now();
+
+	for (i = 0; i < count; i++)
+	{
+		offset = (off_t) (random() % (st.st_size / RAND_BLOCK)) * RAND_BLOCK;
+
+		start = now();
+		if (pread(fd, buf, RAND_BLOCK, offset) < 0)
+		{
+			return 1;
+		}
+		samples[i] = now() - start;
+	}
+
+	total = now() - total;
+	close(fd);
+
+	printf("{\"workload\": \"rand_read\", \"iops\": %.1f, ", count / total);
+	print_latencies(samples, count);
+	printf("}\n");
+
+	free(samples);
+
+	return 0;
+}
+
+/**
+ * Stat of randomly chosen files
+ */
+static int bench_stat_storm(unsigned int count)
+{
+	struct stat st;
+	double *samples, start, total;
+	unsigned int i;
+	char *path;
+
+	list_files();
+	if (file_count == 0)
+	{
+		return 1;
+	}
+
+	samples = (double*) malloc(count * sizeof(double));
+	if (samples == NULL)
+	{
+		return 1;
+	}
+
+	total = now();
+
+	for (i = 0; i < count; i++)
+	{
+		path = make_path(files[random() % file_count]);
+
+		start = now();
+		if (stat(path, &st) != 0)
+		{
+			return 1;
+		}
+		samples[i] = now() - start;
+
+		free(path);
+	}
+
+	total = now() - total;
+
+	printf("{\"workload\": \"stat_storm\", \"ops_per_s\": %.1f, ", count / total);
+	print_latencies(samples, count);
+	printf("}\n");
+
+	free(samples);
+
+	return 0;
+}
+
+/**
+ * Long listing of the root directory: readdir followed by stat of every entry
+ */
+static int bench_ls_l(void)
+{
+	struct stat st;
+	double start, elapsed;
+	unsigned int i;
+	char *path;
+
+	start = now();
+
+	list_files();
+
+	for (i = 0; i < file_count; i++)
+	{
+		path = make_path(files[i]);
+
+		if (lstat(path, &st) != 0)
+		{
+			return 1;
+		}
+
+		free(path);
+	}
+
+	elapsed = now() - start;
+
+	printf("{\"workload\": \"ls_l\", \"entries\": %u, \"seconds\": %.6f, "
+		"\"entries_per_s\": %.1f}\n", file_count, elapsed, file_count / elapsed);
+
+	return 0;
+}
+
+/**
+ * Reading of many small files in listing order, like "cat *" does
+ */
+static int bench_small_files(const char *label, unsigned int count)
+{
+	long long before, after, bytes, n;
+	double start, elapsed;
+	unsigned int i;
+	char *path;
+
+	list_files();
+	if (count > file_count)
+	{
+		count = file_count;
+	}
+
+	before = server_queries();
+	start = now();
+
+	bytes = 0;
+	for (i = 0; i < count; i++)
+	{
+		path = make_path(files[i]);
+		n = read_file(path);
+		free(path);
+
+		if (n < 0)
+		{
+			return 1;
+		}
+
+		bytes += n;
+	}
+
+	elapsed = now() - start;
+	after = server_queries();
+
+	printf("{\"workload\": \"%s\", \"files\": %u, \"bytes\": %lld, \"seconds\": %.6f, "
+		"\"files_per_s\": %.1f", label, count, bytes, elapsed, count / elapsed);
+
+	if (before >= 0 && after >= 0 && count > 0)
+	{
+		printf(", \"round_trips_per_1000_files\": %.1f",
+			(after - before) * 1000.0 / count);
+	}
+
+	printf("}\n");
+
+	return 0;
+}
+
+/**
+ * CPU cost of single file system operations: op (getattr, open or read of
+ * the first 4K) is applied count times to files in listing order, and CPU
+ * time MyBlobFS used meanwhile is divided by count
+ */
+static int bench_op_cpu(const char *op, unsigned int count)
+{
+	long long cpu_before, cpu_after, queries_before, queries_after;
+	char *path, buf[RAND_BLOCK];
+	struct stat st;
+	double start, elapsed;
+	unsigned int i;
+	int fd, failed;
+
+	if (strcmp(op, "getattr") != 0 && strcmp(op, "open") != 0 && strcmp(op, "read") != 0)
+	{
+		errno = EINVAL;
+		return 1;
+	}
+
+	list_files();
+	if (file_count == 0)
+	{
+		return 1;
+	}
+
+	queries_before = server_queries();
+	cpu_before = server_cpu();
+	start = now();
+
+	for (i = 0; i < count; i++)
+	{
+		path = make_path(files[i % file_count]);
+
+		if (strcmp(op, "getattr") == 0)
+		{
+			failed = stat(path, &st) != 0;
+		}
+		else
+		{
+			fd = open(path, O_RDONLY);
+			failed = fd < 0;
+
+			if (!failed && strcmp(op, "read") == 0)
+			{
+				failed = pread(fd, buf, RAND_BLOCK, 0) < 0;
+			}
+
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+		}
+
+		free(path);
+
+		if (failed)
+		{
+			return 1;
+		}
+	}
+
+	elapsed = now() - start;
+	cpu_after = server_cpu();
+	queries_after = server_queries();
+
+	printf("{\"workload\": \"op_cpu\", \"op\": \"%s\", \"ops\": %u, \"ops_per_s\": %.1f",
+		op, count, count / elapsed);
+
+	if (cpu_before >= 0 && cpu_after >= 0 && count > 0)
+	{
+		printf(", \"cpu_us_per_op\": %.2f, \"queries_per_op\": %.2f",
+			(double) (cpu_after - cpu_before) / count,
+			(double) (queries_after - queries_before) / count);
+	}
+
+	printf("}\n");
+
+	return 0;
+}
+
+/**
+ * Reads the file of a parallel reader. Runs as a thread
+ */
+static void *reader_run(void *arg)
+{
+	struct reader *r = (struct reader*) arg;
+
+	r->bytes = read_file(r->path);
+
+	return NULL;
+}
+
+/**
+ * Several threads reading the same large file concurrently
+ */
+static int bench_parallel(const char *name, unsigned int threads)
+{
+	struct reader *readers;
+	pthread_t *ids;
+	long long bytes;
+	double start, elapsed;
+	unsigned int i;
+
+	readers = (struct reader*) calloc(threads, sizeof(struct reader));
+	ids = (pthread_t*) calloc(threads, sizeof(pthread_t));
+
+	if (readers == NULL || ids == NULL)
+	{
+		return 1;
+	}
+
+	start = now();
+
+	for (i = 0; i < threads; i++)
+	{
+		readers[i].path = make_path(name);
+		if (pthread_create(&ids[i], NULL, reader_run, &readers[i]) != 0)
+		{
+			return 1;
+		}
+	}
+
+	bytes = 0;
+	for (i = 0; i < threads; i++)
+	{
+		pthread_join(ids[i], NULL);
+
+		if (readers[i].bytes < 0)
+		{
+			return 1;
+		}
+
+		bytes += readers[i].bytes;
+		free(readers[i].path);
+	}
+
+	elapsed = now() - start;
+
+	printf("{\"workload\": \"parallel_read\", \"threads\": %u, \"bytes\": %lld, "
+		"\"seconds\": %.6f, \"mb_per_s\": %.2f}\n", threads, bytes, elapsed,
+		bytes / elapsed / 1048576);
+
+	free(readers);
+	free(ids);
+
+	return 0;
+}
+
+/**
+ * Prints usage information
+ */
+static void usage(void)
+{
+	puts("Usage: myblobfs-bench MOUNTPOINT WORKLOAD [ARGS]\n"
+		"Workloads:\n"
+		"  seq_read FILE\n"
+		"  rand_read FILE COUNT\n"
+		"  stat_storm COUNT\n"
+		"  ls_l\n"
+		"  small_files LABEL COUNT\n"
+		"  parallel_read FILE THREADS\n"
+		"  op_cpu getattr|open|read COUNT");
+}
+
+/**
+ * Program entry point
+ */
+int main(int argc, char *argv[])
+{
+	int result;
+
+	if (argc < 3)
+	{
+		usage();
+		return 2;
+	}
+
+	mount_point = argv[1];
+	srandom(getpid());
+
+	if (strcmp(argv[2], "seq_read") == 0 && argc == 4)
+	{
+		result = bench_seq_read(argv[3]);
+	}
+	else if (strcmp(argv[2], "rand_read") == 0 && argc == 5)
+	{
+		result = bench_rand_read(argv[3], atoi(argv[4]));
+	}
+	else if (strcmp(argv[2], "stat_storm") == 0 && argc == 4)
+	{
+		result = bench_stat_storm(atoi(argv[3]));
+	}
+	else if (strcmp(argv[2], "ls_l") == 0 && argc == 3)
+	{
+		result = bench_ls_l();
+	}
+	else if (strcmp(argv[2], "small_files") == 0 && argc == 5)
+	{
+		result = bench_small_files(argv[3], atoi(argv[4]));
+	}
+	else if (strcmp(argv[2], "parallel_read") == 0 && argc == 5)
+	{
+		result = bench_parallel(argv[3], atoi(argv[4]));
+	}
+	else if (strcmp(argv[2], "op_cpu") == 0 && argc == 5)
+	{
+		result = bench_op_cpu(argv[3], atoi(argv[4]));
+	}
+	else
+	{
+		usage();
+		return 2;
+	}
+
+	if (result != 0)
+	{
+		fprintf(stderr, "myblobfs-bench: %s failed: %s\n", argv[2], strerror(errno));
+	}
+
+	return result;
+}
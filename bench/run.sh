@@ -0,0 +1,212 @@
+#!/bin/sh
+#
+# MyBlobFS benchmark suite. Starts a throwaway MySQL server, seeds a table
+# with myblobfs-gen: small rows of log-normally distributed size and one
+# large row, mounts it with MyBlobFS and runs the
+# standard workloads. Results are printed to standard output as JSON;
+# progress goes to standard error.
+#
+# Settings (environment variables):
+#   BENCH_ROWS         number of small rows (default: 10000)
+#   BENCH_SIZE_MEDIAN  median small row size, bytes (default: 4096)
+#   BENCH_SIZE_SIGMA   log-normal shape of small row sizes (default: 1)
+#   BENCH_MAX_SIZE     largest small row, bytes (default: 65536)
+#   BENCH_CONTENT      row content: random, text or mixed (default: mixed)
+#   BENCH_PROFILE      myblobfs-gen profile file, overriding the above; it
+#                      must keep rows, id-gap and outliers in line with
+#                      BENCH_ROWS, so that the large row stays last
+#   BENCH_LARGE_SIZE   size of the large row, bytes (default: 67108864)
+#   BENCH_OPTS         extra MyBlobFS options for the mount
+#   BENCH_PREFETCH     --prefetch value for the second small files run
+#                      (default: 64; 0 skips the run)
+#   BENCH_RAND_READS   number of random 4K reads (default: 2000)
+#   BENCH_STATS        number of stat calls in the stat storm (default: 5000)
+#   BENCH_SMALL_FILES  number of small files read (default: 1000)
+#   BENCH_THREADS      number of parallel readers (default: 4)
+#   BENCH_PORT         TCP port of the throwaway server (default: 33306)
+#   MYSQLD             MySQL server binary (default: mysqld)
+#
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+
+BENCH_ROWS=${BENCH_ROWS:-10000}
+BENCH_SIZE_MEDIAN=${BENCH_SIZE_MEDIAN:-4096}
+BENCH_SIZE_SIGMA=${BENCH_SIZE_SIGMA:-1}
+BENCH_MAX_SIZE=${BENCH_MAX_SIZE:-65536}
+BENCH_CONTENT=${BENCH_CONTENT:-mixed}
+BENCH_PROFILE=${BENCH_PROFILE:-}
+BENCH_LARGE_SIZE=${BENCH_LARGE_SIZE:-67108864}
+BENCH_OPTS=${BENCH_OPTS:-}
+BENCH_PREFETCH=${BENCH_PREFETCH:-64}
+BENCH_RAND_READS=${BENCH_RAND_READS:-2000}
+BENCH_STATS=${BENCH_STATS:-5000}
+BENCH_SMALL_FILES=${BENCH_SMALL_FILES:-1000}
+BENCH_THREADS=${BENCH_THREADS:-4}
+BENCH_PORT=${BENCH_PORT:-33306}
+MYSQLD=${MYSQLD:-mysqld}
+
+MYBLOBFS="$ROOT/src/myblobfs"
+DRIVER="$ROOT/bench/myblobfs-bench"
+GEN="$ROOT/src/myblobfs-gen"
+
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/myblobfs-bench.XXXXXX")
+DATA="$WORK/data"
+MNT="$WORK/mnt"
+SOCK="$WORK/mysql.sock"
+RESULTS="$WORK/results"
+LARGE=$((BENCH_ROWS + 1))
+
+log()
+{
+	echo "bench: $*" >&2
+}
+
+sql()
+{
+	mysql --no-defaults --socket="$SOCK" --user=root "$@"
+}
+
+unmount()
+{
+	if mountpoint -q "$MNT" 2>/dev/null
+	then
+		fusermount -u "$MNT" || umount "$MNT"
+	fi
+}
+
+cleanup()
+{
+	unmount
+	mysqladmin --no-defaults --socket="$SOCK" --user=root shutdown >/dev/null 2>&1 || true
+	rm -rf "$WORK"
+}
+
+trap cleanup EXIT INT TERM
+
+#
+# Start a throwaway server
+#
+
+mkdir -p "$DATA" "$MNT"
+
+log "initializing server in $WORK"
+
+if ! "$MYSQLD" --no-defaults --initialize-insecure --datadir="$DATA" >"$WORK/init.log" 2>&1
+then
+	if command -v mariadb-install-db >/dev/null 2>&1
+	then
+		mariadb-install-db --no-defaults --datadir="$DATA" >"$WORK/init.log" 2>&1
+	else
+		mysql_install_db --no-defaults --datadir="$DATA" >"$WORK/init.log" 2>&1
+	fi
+fi
+
+"$MYSQLD" --no-defaults --datadir="$DATA" --socket="$SOCK" --port="$BENCH_PORT" \
+	--bind-address=127.0.0.1 --pid-file="$WORK/mysqld.pid" \
+	--max-allowed-packet=1G --log-error="$WORK/mysqld.log" &
+
+for i in $(seq 1 60)
+do
+	if mysqladmin --no-defaults --socket="$SOCK" --user=root ping >/dev/null 2>&1
+	then
+		break
+	fi
+
+	sleep 1
+done
+
+#
+# Seed the table: small rows first, then the large row as the only outlier,
+# so that it gets the last id. Settings from the profile file, if any, come
+# last and win
+#
+
+log "seeding $BENCH_ROWS rows"
+
+sql -e "CREATE DATABASE bench"
+
+"$GEN" --host=127.0.0.1 --port="$BENCH_PORT" --user=root \
+	--database=bench --table=blobs --name-field=id --data-field=data --create \
+	--rows="$BENCH_ROWS" --size-median="$BENCH_SIZE_MEDIAN" \
+	--size-sigma="$BENCH_SIZE_SIGMA" --max-size="$BENCH_MAX_SIZE" \
+	--content="$BENCH_CONTENT" --outliers=1 --outlier-size="$BENCH_LARGE_SIZE" \
+	${BENCH_PROFILE:+--profile="$BENCH_PROFILE"} >&2
+
+#
+# Mount and run the workloads
+#
+
+mount_fs()
+{
+	"$MYBLOBFS" --host=127.0.0.1 --port="$BENCH_PORT" --user=root \
+		--database=bench --table=blobs --name-field=id --data-field=data \
+		"$@" "$MNT"
+
+	for i in $(seq 1 30)
+	do
+		if [ -e "$MNT/.myblobfs/stats" ]
+		then
+			return
+		fi
+
+		sleep 1
+	done
+
+	log "mount failed"
+	exit 1
+}
+
+run()
+{
+	log "running $*"
+	"$DRIVER" "$MNT" "$@" >>"$RESULTS"
+}
+
+: >"$RESULTS"
+
+mount_fs $BENCH_OPTS
+
+run op_cpu getattr "$BENCH_SMALL_FILES"
+run op_cpu open "$BENCH_SMALL_FILES"
+run op_cpu read "$BENCH_SMALL_FILES"
+run seq_read "$LARGE"
+run rand_read "$LARGE" "$BENCH_RAND_READS"
+run stat_storm "$BENCH_STATS"
+run ls_l
+run small_files small_files "$BENCH_SMALL_FILES"
+run parallel_read "$LARGE" "$BENCH_THREADS"
+
+unmount
+
+if [ "$BENCH_PREFETCH" -gt 0 ]
+then
+	mount_fs $BENCH_OPTS --prefetch="$BENCH_PREFETCH"
+	run small_files small_files_prefetch "$BENCH_SMALL_FILES"
+	unmount
+fi
+
+#
+# Print results
+#
+
+commit=$(git -C "$ROOT" rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+cat <<JSON
+{
+  "commit": "$commit",
+  "date": "$(date -u +%Y-%m-%dT%H:%M:%SZ)",
+  "rows": $BENCH_ROWS,
+  "size_median": $BENCH_SIZE_MEDIAN,
+  "size_sigma": $BENCH_SIZE_SIGMA,
+  "max_size": $BENCH_MAX_SIZE,
+  "content": "$BENCH_CONTENT",
+  "profile": "$BENCH_PROFILE",
+  "large_size": $BENCH_LARGE_SIZE,
+  "options": "$BENCH_OPTS",
+  "results": [
+$(sed -e 's/^/    /' -e '$!s/$/,/' "$RESULTS")
+  ]
+}
+JSON
@@ -0,0 +1,850 @@
+/**
+ * MyBlobFS-Gen - synthetic dataset generator filling MySQL tables with rows
+ *   that look like production BLOB tables, for benchmarking MyBlobFS
+ *
+ * Copyright (C) 2008, 2009 Olexandr Melnyk <me@omelnyk.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <mysql/mysql.h>
+
+/**
+ * Largest number of loader threads
+ */
+#define MAX_THREADS 64
+
+/**
+ * Size of chunks large rows are appended in
+ */
+#define CHUNK_SIZE 8388608
+
+/**
+ * Kinds of generated content
+ */
+enum content
+{
+	CONTENT_RANDOM,
+	CONTENT_TEXT,
+	CONTENT_MIXED
+};
+
+/**
+ * Dataset profile and connection settings
+ */
+struct profile
+{
+	/**
+	 * MySQL server, credentials and target table
+	 */
+	char *hostname;
+	unsigned int port;
+	char *username;
+	char *password;
+	int rq_password;
+	char *database;
+	char *table;
+	char *name_field;
+	char *data_field;
+
+	/**
+	 * Whether to (re)create the table
+	 */
+	int create;
+
+	/**
+	 * Number of regular rows
+	 */
+	unsigned long long rows;
+
+	/**
+	 * Median and shape of the log-normal row size distribution, and the
+	 * largest regular row
+	 */
+	double size_median;
+	double size_sigma;
+	unsigned long long max_size;
+
+	/**
+	 * Number and size of outlier rows, added after the regular ones
+	 */
+	unsigned long long outliers;
+	unsigned long long outlier_size;
+
+	/**
+	 * Average distance between consecutive ids (1 for dense ids)
+	 */
+	unsigned int id_gap;
+
+	/**
+	 * Kind of content
+	 */
+	enum content content;
+
+	/**
+	 * Largest number of rows and bytes per INSERT statement
+	 */
+	unsigned int batch_rows;
+	unsigned long batch_bytes;
+
+	/**
+	 * Number of loader threads
+	 */
+	unsigned int threads;
+
+	/**
+	 * Random seed, so that datasets can be reproduced
+	 */
+	unsigned long long seed;
+};
+
+/**
+ * Loader thread state
+ */
+struct loader
+{
+	/**
+	 * Index of the thread; it loads every threads-th row starting from it
+	 */
+	unsigned int index;
+
+	/**
+	 * Random generator state
+	 */
+	unsigned long long rng;
+
+	/**
+	 * Number of rows and bytes loaded
+	 */
+	unsigned long long rows, bytes;
+
+	/**
+	 * Whether loading failed
+	 */
+	int failed;
+};
+
+/**
+ * Dataset profile
+ */
+static struct profile prof;
+
+/**
+ * Words text content is made of
+ */
+static const char *words[] =
+{
+	"lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+	"elit", "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore",
+	"et", "dolore", "magna", "aliqua", "\n"
+};
+
+/**
+ * Returns next value of the xorshift64* generator with state rng
+ */
+static unsigned long long rng_next(unsigned long long *rng)
+{
+	*rng ^= *rng >> 12;
+	*rng ^= *rng << 25;
+	*rng ^= *rng >> 27;
+
+	return *rng * 2685821657736338717ULL;
+}
+
+/**
+ * Returns uniformly distributed number in (0, 1)
+ */
+static double rng_uniform(unsigned long long *rng)
+{
+	return ((rng_next(rng) >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/**
+ * Returns seeded generator state for row, so that every row gets the same
+ * content regardless of which thread loads it
+ */
+static unsigned long long rng_for(unsigned long long row)
+{
+	unsigned long long rng;
+
+	rng = (prof.seed + 1) * 0x9E3779B97F4A7C15ULL ^ (row + 1) * 0xBF58476D1CE4E5B9ULL;
+	if (rng == 0)
+	{
+		rng = 1;
+	}
+
+	rng_next(&rng);
+
+	return rng;
+}
+
+/**
+ * Returns id of the row-th row. Ids are increasing; with a gap larger than
+ * one they are spread randomly, gap apart on average
+ */
+static unsigned long long row_id(unsigned long long row)
+{
+	unsigned long long rng;
+
+	if (prof.id_gap <= 1)
+	{
+		return row + 1;
+	}
+
+	rng = rng_for(row ^ 0x5555555555555555ULL);
+
+	return row * prof.id_gap + rng_next(&rng) % prof.id_gap + 1;
+}
+
+/**
+ * Returns size of the row-th row
+ */
+static unsigned long long row_size(unsigned long long row, unsigned long long *rng)
+{
+	double z, size;
+
+	if (row >= prof.rows)
+	{
+		return prof.outlier_size;
+	}
+
+	//
+	// Box-Muller transform gives a standard normal value, which is then
+	// mapped to the log-normal distribution
+	//
+
+	z = sqrt(-2 * log(rng_uniform(rng))) * cos(2 * M_PI * rng_uniform(rng));
+	size = exp(log(prof.size_median) + prof.size_sigma * z);
+
+	if (size > prof.max_size)
+	{
+		size = prof.max_size;
+	}
+
+	return (unsigned long long) size;
+}
+
+/**
+ * Fills len bytes of buf with content of the kind
+ */
+static void fill_content(char *buf, unsigned long len, enum content kind,
+	unsigned long long *rng)
+{
+	unsigned long long r;
+	unsigned long i, w;
+	const char *word;
+
+	if (kind == CONTENT_MIXED)
+	{
+		kind = rng_next(rng) & 1 ? CONTENT_TEXT : CONTENT_RANDOM;
+	}
+
+	if (kind == CONTENT_RANDOM)
+	{
+		for (i = 0; i + 8 <= len; i += 8)
+		{
+			r = rng_next(rng);
+			memcpy(buf + i, &r, 8);
+		}
+
+		r = rng_next(rng);
+		memcpy(buf + i, &r, len - i);
+		return;
+	}
+
+	for (i = 0; i < len; )
+	{
+		word = words[rng_next(rng) % (sizeof(words) / sizeof(words[0]))];
+
+		for (w = 0; word[w] != '\0' && i < len; w++)
+		{
+			buf[i++] = word[w];
+		}
+
+		if (i < len)
+		{
+			buf[i++] = ' ';
+		}
+	}
+}
+
+/**
+ * Connects to the server. Returns NULL on failure
+ */
+static MYSQL *connect_server(void)
+{
+	MYSQL *mysql;
+
+	mysql = mysql_init(NULL);
+	if (mysql == NULL)
+	{
+		return NULL;
+	}
+
+	if (mysql_real_connect(mysql, prof.hostname, prof.username, prof.password,
+		prof.database, prof.port, NULL, 0) == NULL)
+	{
+		fprintf(stderr, "%s\n", mysql_error(mysql));
+		mysql_close(mysql);
+		return NULL;
+	}
+
+	return mysql;
+}
+
+/**
+ * Runs query, reporting errors. Returns if it succeeded
+ */
+static int run_query(MYSQL *mysql, const char *query, unsigned long len)
+{
+	if (mysql_real_query(mysql, query, len) != 0)
+	{
+		fprintf(stderr, "%s\n", mysql_error(mysql));
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Inserts a row too large for one statement: first empty, then appending
+ * its content chunk by chunk. Returns if it succeeded
+ */
+static int load_large_row(MYSQL *mysql, unsigned long long id,
+	unsigned long long size, unsigned long long *rng, char *chunk, char *query)
+{
+	unsigned long long done;
+	unsigned long len;
+	char *p;
+
+	p = query + sprintf(query, "INSERT INTO %s (%s, %s) VALUES (%llu, '')",
+		prof.table, prof.name_field, prof.data_field, id);
+
+	if (!run_query(mysql, query, p - query))
+	{
+		return 0;
+	}
+
+	for (done = 0; done < size; done += len)
+	{
+		len = size - done < CHUNK_SIZE ? size - done : CHUNK_SIZE;
+		fill_content(chunk, len, prof.content, rng);
+
+		p = query + sprintf(query, "UPDATE %s SET %s = CONCAT(%s, '",
+			prof.table, prof.data_field, prof.data_field);
+		p += mysql_real_escape_string(mysql, p, chunk, len);
+		p += sprintf(p, "') WHERE %s = %llu", prof.name_field, id);
+
+		if (!run_query(mysql, query, p - query))
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Loads every threads-th row, starting from the loader's index, in
+ * multi-row INSERT statements. Runs as a thread
+ */
+static void *load(void *arg)
+{
+	struct loader *loader = (struct loader*) arg;
+	unsigned long long row, total, size, rng;
+	unsigned int batched;
+	char *query, *p, *content;
+	size_t capacity;
+	MYSQL *mysql;
+
+	mysql = connect_server();
+	if (mysql == NULL)
+	{
+		loader->failed = 1;
+		return NULL;
+	}
+
+	//
+	// A statement holds at most batch_bytes of escaped content; anything
+	// larger goes through load_large_row()
+	//
+
+	capacity = 2 * (prof.batch_bytes > CHUNK_SIZE ? prof.batch_bytes : CHUNK_SIZE) + 4096;
+	query = (char*) malloc(capacity);
+	content = (char*) malloc(prof.batch_bytes > CHUNK_SIZE ? prof.batch_bytes : CHUNK_SIZE);
+
+	if (query == NULL || content == NULL)
+	{
+		fprintf(stderr, "Out of memory\n");
+		loader->failed = 1;
+		free(query);
+		free(content);
+		mysql_close(mysql);
+		return NULL;
+	}
+
+	total = prof.rows + prof.outliers;
+	batched = 0;
+	p = query;
+
+	for (row = loader->index; row < total && !loader->failed; row += prof.threads)
+	{
+		rng = rng_for(row);
+		size = row_size(row, &rng);
+
+		if (size > prof.batch_bytes)
+		{
+			loader->failed = !load_large_row(mysql, row_id(row), size, &rng, content, query);
+			loader->rows++;
+			loader->bytes += size;
+			continue;
+		}
+
+		//
+		// Flush the batch if this row does not fit into it
+		//
+
+		if (batched > 0 && ((size_t) (p - query) + 2 * size + 64 > capacity ||
+			batched == prof.batch_rows))
+		{
+			loader->failed = !run_query(mysql, query, p - query);
+			batched = 0;
+		}
+
+		if (batched == 0)
+		{
+			p = query + sprintf(query, "INSERT INTO %s (%s, %s) VALUES ",
+				prof.table, prof.name_field, prof.data_field);
+		}
+
+		fill_content(content, size, prof.content, &rng);
+
+		p += sprintf(p, "%s(%llu, '", batched > 0 ? "," : "", row_id(row));
+		p += mysql_real_escape_string(mysql, p, content, size);
+		*p++ = '\'';
+		*p++ = ')';
+
+		batched++;
+		loader->rows++;
+		loader->bytes += size;
+	}
+
+	if (batched > 0 && !loader->failed)
+	{
+		loader->failed = !run_query(mysql, query, p - query);
+	}
+
+	free(query);
+	free(content);
+	mysql_close(mysql);
+
+	return NULL;
+}
+
+/**
+ * Returns if str is a valid MySQL identifier, which can be used without
+ * being enclosed in hyphens
+ */
+static int is_valid_ident(const char *str)
+{
+	if (str == NULL || *str == '\0')
+	{
+		return 0;
+	}
+
+	for (; *str; str++)
+	{
+		if (!isalnum((unsigned char) *str) && *str != '_')
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Sets profile setting key to value. Returns if the setting is known and the
+ * value is valid
+ */
+static int set_option(const char *key, const char *value)
+{
+	char *copy;
+
+	copy = strdup(value);
+	if (copy == NULL)
+	{
+		return 0;
+	}
+
+	if (strcmp(key, "host") == 0)
+	{
+		prof.hostname = copy;
+		return 1;
+	}
+
+	if (strcmp(key, "user") == 0)
+	{
+		prof.username = copy;
+		return 1;
+	}
+
+	if (strcmp(key, "database") == 0)
+	{
+		prof.database = copy;
+		return 1;
+	}
+
+	if (strcmp(key, "table") == 0)
+	{
+		prof.table = copy;
+		return 1;
+	}
+
+	if (strcmp(key, "name-field") == 0)
+	{
+		prof.name_field = copy;
+		return 1;
+	}
+
+	if (strcmp(key, "data-field") == 0)
+	{
+		prof.data_field = copy;
+		return 1;
+	}
+
+	free(copy);
+
+	if (strcmp(key, "content") == 0)
+	{
+		if (strcmp(value, "random") == 0)
+		{
+			prof.content = CONTENT_RANDOM;
+		}
+		else if (strcmp(value, "text") == 0)
+		{
+			prof.content = CONTENT_TEXT;
+		}
+		else if (strcmp(value, "mixed") == 0)
+		{
+			prof.content = CONTENT_MIXED;
+		}
+		else
+		{
+			return 0;
+		}
+
+		return 1;
+	}
+
+	if (strcmp(key, "size-median") == 0)
+	{
+		prof.size_median = atof(value);
+		return prof.size_median >= 1;
+	}
+
+	if (strcmp(key, "size-sigma") == 0)
+	{
+		prof.size_sigma = atof(value);
+		return prof.size_sigma >= 0;
+	}
+
+	if (!isdigit((unsigned char) *value))
+	{
+		return 0;
+	}
+
+	if (strcmp(key, "port") == 0)
+	{
+		prof.port = strtoul(value, NULL, 10);
+	}
+	else if (strcmp(key, "rows") == 0)
+	{
+		prof.rows = strtoull(value, NULL, 10);
+	}
+	else if (strcmp(key, "max-size") == 0)
+	{
+		prof.max_size = strtoull(value, NULL, 10);
+	}
+	else if (strcmp(key, "outliers") == 0)
+	{
+		prof.outliers = strtoull(value, NULL, 10);
+	}
+	else if (strcmp(key, "outlier-size") == 0)
+	{
+		prof.outlier_size = strtoull(value, NULL, 10);
+	}
+	else if (strcmp(key, "id-gap") == 0)
+	{
+		prof.id_gap = strtoul(value, NULL, 10);
+	}
+	else if (strcmp(key, "batch-rows") == 0)
+	{
+		prof.batch_rows = strtoul(value, NULL, 10);
+	}
+	else if (strcmp(key, "batch-bytes") == 0)
+	{
+		prof.batch_bytes = strtoul(value, NULL, 10);
+	}
+	else if (strcmp(key, "threads") == 0)
+	{
+		prof.threads = strtoul(value, NULL, 10);
+	}
+	else if (strcmp(key, "seed") == 0)
+	{
+		prof.seed = strtoull(value, NULL, 10);
+	}
+	else
+	{
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Reads profile settings from file, one "key = value" per line. Empty lines
+ * and lines starting with "#" are ignored. Returns if all settings are valid
+ */
+static int read_profile(const char *path)
+{
+	char line[1024], *key, *value, *end;
+	unsigned int lineno;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (f == NULL)
+	{
+		perror(path);
+		return 0;
+	}
+
+	for (lineno = 1; fgets(line, sizeof(line), f) != NULL; lineno++)
+	{
+		for (key = line; isspace((unsigned char) *key); key++);
+
+		if (*key == '\0' || *key == '#')
+		{
+			continue;
+		}
+
+		value = strchr(key, '=');
+		if (value == NULL)
+		{
+			fprintf(stderr, "%s:%u: Expected \"key = value\"\n", path, lineno);
+			fclose(f);
+			return 0;
+		}
+
+		for (end = value; end > key && isspace((unsigned char) end[-1]); end--);
+		*end = '\0';
+
+		for (value++; isspace((unsigned char) *value); value++);
+		for (end = value + strlen(value); end > value && isspace((unsigned char) end[-1]); end--);
+		*end = '\0';
+
+		if (!set_option(key, value))
+		{
+			fprintf(stderr, "%s:%u: Invalid setting \"%s\"\n", path, lineno, key);
+			fclose(f);
+			return 0;
+		}
+	}
+
+	fclose(f);
+
+	return 1;
+}
+
+/**
+ * Prints usage information
+ */
+static void usage(void)
+{
+	puts("Usage: myblobfs-gen [options]\n"
+		"  --profile=FILE        read settings from FILE (\"key = value\" lines)\n"
+		"  --host, --port, --user, -p, --database, --table,\n"
+		"  --name-field, --data-field\n"
+		"                        server and table, as for myblobfs\n"
+		"  --create              drop and create the table first\n"
+		"  --rows=N              number of regular rows (default: 1000)\n"
+		"  --size-median=BYTES   median row size (default: 16384)\n"
+		"  --size-sigma=S        log-normal shape (default: 1.5)\n"
+		"  --max-size=BYTES      largest regular row (default: 67108864)\n"
+		"  --outliers=N          number of outlier rows, added last (default: 0)\n"
+		"  --outlier-size=BYTES  size of outlier rows (default: 2147483648)\n"
+		"  --id-gap=N            average distance between ids (default: 1, dense)\n"
+		"  --content=KIND        random, text or mixed (default: random)\n"
+		"  --batch-rows=N        rows per INSERT (default: 1000)\n"
+		"  --batch-bytes=BYTES   content bytes per INSERT (default: 4194304)\n"
+		"  --threads=N           parallel loaders (default: 4)\n"
+		"  --seed=N              random seed (default: 0)");
+}
+
+/**
+ * Program entry point
+ */
+int main(int argc, char *argv[])
+{
+	struct loader loaders[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	unsigned long long rows, bytes;
+	char *eq, query[1024];
+	unsigned int i;
+	MYSQL *mysql;
+	int failed;
+
+	//
+	// Defaults, then profile file and command-line settings
+	//
+
+	prof.port = 3306;
+	prof.rows = 1000;
+	prof.size_median = 16384;
+	prof.size_sigma = 1.5;
+	prof.max_size = 67108864;
+	prof.outlier_size = 2147483648ULL;
+	prof.id_gap = 1;
+	prof.batch_rows = 1000;
+	prof.batch_bytes = 4194304;
+	prof.threads = 4;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-p") == 0)
+		{
+			prof.rq_password = 1;
+		}
+		else if (strcmp(argv[i], "--create") == 0)
+		{
+			prof.create = 1;
+		}
+		else if (strncmp(argv[i], "--profile=", 10) == 0)
+		{
+			if (!read_profile(argv[i] + 10))
+			{
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--", 2) == 0 && (eq = strchr(argv[i], '=')) != NULL)
+		{
+			*eq = '\0';
+
+			if (!set_option(argv[i] + 2, eq + 1))
+			{
+				fprintf(stderr, "Invalid option \"%s\"\n", argv[i]);
+				return 1;
+			}
+		}
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	if (prof.database == NULL || !is_valid_ident(prof.table) ||
+		!is_valid_ident(prof.name_field) || !is_valid_ident(prof.data_field))
+	{
+		puts("Database, table, name field and data field must be specified");
+		return 1;
+	}
+
+	if (prof.threads == 0 || prof.threads > MAX_THREADS || prof.batch_rows == 0 ||
+		prof.batch_bytes == 0)
+	{
+		puts("Invalid number of threads or batch size");
+		return 1;
+	}
+
+	if (prof.rq_password)
+	{
+		prof.password = getpass("Enter password: ");
+	}
+
+	//
+	// Create the table, if requested
+	//
+
+	mysql_library_init(0, NULL, NULL);
+
+	mysql = connect_server();
+	if (mysql == NULL)
+	{
+		return 1;
+	}
+
+	if (prof.create)
+	{
+		sprintf(query, "DROP TABLE IF EXISTS %s", prof.table);
+
+		if (!run_query(mysql, query, strlen(query)))
+		{
+			return 1;
+		}
+
+		sprintf(query, "CREATE TABLE %s (%s BIGINT UNSIGNED NOT NULL PRIMARY KEY, "
+			"%s LONGBLOB NOT NULL)", prof.table, prof.name_field, prof.data_field);
+
+		if (!run_query(mysql, query, strlen(query)))
+		{
+			return 1;
+		}
+	}
+
+	mysql_close(mysql);
+
+	//
+	// Load rows in parallel
+	//
+
+	memset(loaders, 0, sizeof(loaders));
+
+	for (i = 0; i < prof.threads; i++)
+	{
+		loaders[i].index = i;
+
+		if (pthread_create(&threads[i], NULL, load, &loaders[i]) != 0)
+		{
+			fprintf(stderr, "Unable to start loader thread\n");
+			return 1;
+		}
+	}
+
+	rows = bytes = 0;
+	failed = 0;
+
+	for (i = 0; i < prof.threads; i++)
+	{
+		pthread_join(threads[i], NULL);
+
+		rows += loaders[i].rows;
+		bytes += loaders[i].bytes;
+		failed |= loaders[i].failed;
+	}
+
+	mysql_library_end();
+
+	printf("Loaded %llu rows, %llu bytes\n", rows, bytes);
+
+	return failed;
+}
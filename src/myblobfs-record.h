@@ -0,0 +1,125 @@
+/**
+ * MyBlobFS - format of operation recordings, shared by the file system, which
+ *   writes them, and myblobfs-replay, which re-issues them
+ *
+ * Copyright (C) 2008, 2009 Olexandr Melnyk <me@omelnyk.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MYBLOBFS_RECORD_H
+#define MYBLOBFS_RECORD_H
+
+#include <stdint.h>
+
+/**
+ * A recording is a header followed by fixed-size entries, both in host byte
+ * order. Entries are written in order of completion, which may differ
+ * slightly from order of arrival
+ */
+#define RECORD_MAGIC "MYBFSREC"
+#define RECORD_VERSION 2
+
+/**
+ * Recording header
+ */
+struct record_header
+{
+	/**
+	 * RECORD_MAGIC, without the terminating zero, and RECORD_VERSION
+	 */
+	char magic[8];
+	uint32_t version;
+
+	/**
+	 * Size of an entry, so that readers can skip fields added later
+	 */
+	uint32_t entry_size;
+
+	/**
+	 * Wall clock time recording started, in microseconds since the epoch
+	 */
+	uint64_t started;
+};
+
+/**
+ * Recorded operations. RECORD_DROPPED entries note that the writer fell
+ * behind and size entries were lost. Operations added later follow it, so
+ * that values in older recordings keep their meaning
+ */
+enum record_op
+{
+	RECORD_GETATTR,
+	RECORD_OPEN,
+	RECORD_READDIR,
+	RECORD_READ,
+	RECORD_DROPPED,
+	RECORD_GETXATTR,
+	RECORD_LISTXATTR,
+	RECORD_OPS
+};
+
+/**
+ * Attribute index of getxattr entries for names the file system does not
+ * expose
+ */
+#define RECORD_XATTR_UNKNOWN UINT64_MAX
+
+/**
+ * Recorded operation
+ */
+struct record_entry
+{
+	/**
+	 * Time the operation arrived, in microseconds since recording started,
+	 * and how long it took
+	 */
+	uint64_t start;
+	uint32_t duration;
+
+	/**
+	 * Process that issued the operation
+	 */
+	uint32_t pid;
+
+	/**
+	 * Row name of a file, or the first row name a directory lists (0 for the
+	 * root directory), and byte range of reads. For getxattr, offset is the
+	 * index of the attribute: that of its field in --xattr-fields, or past
+	 * them for the checksum; for getxattr and listxattr, size is that of the
+	 * buffer (0 asks for the size of the value only)
+	 */
+	uint64_t key;
+	uint64_t offset;
+	uint32_t size;
+
+	/**
+	 * 0 or number of bytes read on success, negated error code on failure
+	 */
+	int32_t result;
+
+	/**
+	 * One of record_op
+	 */
+	uint8_t op;
+
+	/**
+	 * For directories, their depth in the shard hierarchy plus one, 0 for
+	 * files. Version 1 recordings only have the root directory, as key 0
+	 */
+	uint8_t depth;
+	uint8_t reserved[6];
+};
+
+#endif
@@ -0,0 +1,703 @@
+/**
+ * MyBlobFS-Replay - re-issues operations recorded by MyBlobFS (--record)
+ *   against a mounted file system, at original or scaled speed
+ *
+ * Copyright (C) 2008, 2009 Olexandr Melnyk <me@omelnyk.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+#include "myblobfs-record.h"
+
+/**
+ * Largest number of replaying threads
+ */
+#define MAX_THREADS 64
+
+/**
+ * Number of files a replaying thread keeps open for reads
+ */
+#define OPEN_FILES 16
+
+/**
+ * Largest number of extended attribute names
+ */
+#define MAX_XATTRS 16
+
+/**
+ * Name getxattr is replayed with for attributes the file system did not
+ * expose, or that were not given
+ */
+#define UNKNOWN_XATTR "user.myblobfs-replay.unknown"
+
+/**
+ * Number of recorded operation kinds
+ */
+#define OPS RECORD_OPS
+
+/**
+ * Names of the operations (RECORD_DROPPED notes are not replayed)
+ */
+static const char *op_names[OPS] = { "getattr", "open", "readdir", "read", NULL,
+	"getxattr", "listxattr" };
+
+/**
+ * Replaying thread state
+ */
+struct player
+{
+	/**
+	 * Indexes of the entries the thread replays, in order of start time
+	 */
+	unsigned long *entries;
+	unsigned long count;
+
+	/**
+	 * Files kept open for reads, replaced round-robin
+	 */
+	uint64_t keys[OPEN_FILES];
+	int fds[OPEN_FILES];
+	unsigned int next_fd;
+};
+
+/**
+ * Mount point and replay speed (0 replays as fast as possible)
+ */
+static const char *mount_point;
+static double speed;
+
+/**
+ * Shard layout of the mount, as given to myblobfs: directory levels, digits
+ * of the row name per level and width row names are zero-padded to
+ */
+static unsigned int shard_levels, shard_digits, shard_width;
+
+/**
+ * Extended attribute names of the mount, in the order their indexes were
+ * recorded in: those of --xattr-fields, then that of the checksum
+ */
+static char *xattr_names[MAX_XATTRS];
+static unsigned int xattr_count;
+
+/**
+ * Recorded entries, sorted by start time
+ */
+static struct record_entry *entries;
+static unsigned long entry_count;
+
+/**
+ * Replayed latency of every entry, in microseconds, whether its outcome
+ * (success or failure) differed from the recorded one, and how late it was
+ * issued
+ */
+static double *latencies, *lateness;
+static char *mismatches;
+
+/**
+ * Time the replay started
+ */
+static struct timespec replay_started;
+
+/**
+ * Returns microseconds elapsed since start
+ */
+static double elapsed_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1e6 + (now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+/**
+ * Returns 10 raised to the power of n
+ */
+static unsigned long long pow10_ull(unsigned int n)
+{
+	unsigned long long result;
+
+	for (result = 1; n > 0; n--)
+	{
+		result *= 10;
+	}
+
+	return result;
+}
+
+/**
+ * Formats path inside the mount point into path: of the row key if depth
+ * is 0, else of the shard directory at depth - 1 that lists key
+ */
+static void make_path(char *path, size_t size, uint64_t key, unsigned int depth)
+{
+	unsigned int levels, level;
+	size_t length;
+
+	if (depth == 0 && key == 0)
+	{
+		depth = 1;
+	}
+
+	levels = depth > 0 ? depth - 1 : shard_levels;
+	length = snprintf(path, size, "%s", mount_point);
+
+	for (level = 1; level <= levels && length < size; level++)
+	{
+		length += snprintf(path + length, size - length, "/%0*llu", (int) shard_digits,
+			(unsigned long long) (key / pow10_ull(shard_width - level * shard_digits) %
+			pow10_ull(shard_digits)));
+	}
+
+	if (length >= size)
+	{
+		return;
+	}
+
+	if (depth > 0)
+	{
+		snprintf(path + length, size - length, "/");
+	}
+	else if (shard_levels > 0)
+	{
+		snprintf(path + length, size - length, "/%0*llu", (int) shard_width,
+			(unsigned long long) key);
+	}
+	else
+	{
+		snprintf(path + length, size - length, "/%llu", (unsigned long long) key);
+	}
+}
+
+/**
+ * Returns descriptor of the row key opened for reading, from the thread's
+ * open files where possible, or -1
+ */
+static int open_cached(struct player *player, uint64_t key)
+{
+	char path[4096];
+	unsigned int i;
+
+	for (i = 0; i < OPEN_FILES; i++)
+	{
+		if (player->fds[i] >= 0 && player->keys[i] == key)
+		{
+			return player->fds[i];
+		}
+	}
+
+	i = player->next_fd;
+	player->next_fd = (i + 1) % OPEN_FILES;
+
+	if (player->fds[i] >= 0)
+	{
+		close(player->fds[i]);
+	}
+
+	make_path(path, sizeof(path), key, 0);
+
+	player->keys[i] = key;
+	player->fds[i] = open(path, O_RDONLY);
+
+	return player->fds[i];
+}
+
+/**
+ * Issues one recorded operation. Returns 0 or number of bytes read on
+ * success, negated error code on failure
+ */
+static int replay_entry(struct player *player, const struct record_entry *entry)
+{
+	char path[4096], *buf;
+	struct stat st;
+	ssize_t n;
+	DIR *dir;
+	int fd;
+
+	make_path(path, sizeof(path), entry->key, entry->depth);
+
+	switch (entry->op)
+	{
+	case RECORD_GETATTR:
+		return stat(path, &st) == 0 ? 0 : -errno;
+
+	case RECORD_OPEN:
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+		{
+			return -errno;
+		}
+
+		close(fd);
+		return 0;
+
+	case RECORD_READDIR:
+		dir = opendir(path);
+		if (dir == NULL)
+		{
+			return -errno;
+		}
+
+		while (readdir(dir) != NULL);
+		closedir(dir);
+		return 0;
+
+	case RECORD_READ:
+		fd = open_cached(player, entry->key);
+		if (fd < 0)
+		{
+			return -errno;
+		}
+
+		buf = (char*) malloc(entry->size > 0 ? entry->size : 1);
+		if (buf == NULL)
+		{
+			return -ENOMEM;
+		}
+
+		n = pread(fd, buf, entry->size, entry->offset);
+		free(buf);
+
+		return n >= 0 ? (int) n : -errno;
+
+	case RECORD_GETXATTR:
+	case RECORD_LISTXATTR:
+		buf = (char*) malloc(entry->size > 0 ? entry->size : 1);
+		if (buf == NULL)
+		{
+			return -ENOMEM;
+		}
+
+		if (entry->op == RECORD_LISTXATTR)
+		{
+			n = listxattr(path, buf, entry->size);
+		}
+		else
+		{
+			n = getxattr(path, entry->offset < xattr_count ? xattr_names[entry->offset] :
+				UNKNOWN_XATTR, buf, entry->size);
+		}
+
+		free(buf);
+
+		return n >= 0 ? (int) n : -errno;
+	}
+
+	return -EINVAL;
+}
+
+/**
+ * Replays the entries of a thread, waiting for the time each one was
+ * originally issued at, scaled by speed. Runs as a thread
+ */
+static void *play(void *arg)
+{
+	struct player *player = (struct player*) arg;
+	const struct record_entry *entry;
+	struct timespec start;
+	double due, now;
+	unsigned long i, index;
+	int result;
+
+	for (i = 0; i < player->count; i++)
+	{
+		index = player->entries[i];
+		entry = &entries[index];
+
+		if (speed > 0)
+		{
+			due = (entry->start - entries[0].start) / speed;
+			now = elapsed_since(&replay_started);
+
+			if (due > now)
+			{
+				usleep((useconds_t) (due - now));
+			}
+
+			lateness[index] = elapsed_since(&replay_started) - due;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		result = replay_entry(player, entry);
+		latencies[index] = elapsed_since(&start);
+
+		mismatches[index] = (result < 0) != (entry->result < 0);
+	}
+
+	for (i = 0; i < OPEN_FILES; i++)
+	{
+		if (player->fds[i] >= 0)
+		{
+			close(player->fds[i]);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Orders entries by start time
+ */
+static int compare_entries(const void *a, const void *b)
+{
+	const struct record_entry *x = (const struct record_entry*) a;
+	const struct record_entry *y = (const struct record_entry*) b;
+
+	return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/**
+ * Orders doubles ascending
+ */
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double*) a, y = *(const double*) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * Reads the recording at path into entries, dropping RECORD_DROPPED notes
+ * (counted into lost) and sorting the rest by start time. Returns if it
+ * succeeded
+ */
+static int load(const char *path, unsigned long *lost)
+{
+	struct record_header header;
+	struct record_entry entry;
+	unsigned long capacity;
+	char *raw;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (f == NULL)
+	{
+		perror(path);
+		return 0;
+	}
+
+	if (fread(&header, sizeof(header), 1, f) != 1 ||
+		memcmp(header.magic, RECORD_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version > RECORD_VERSION || header.entry_size < sizeof(struct record_entry))
+	{
+		fprintf(stderr, "%s: Not a MyBlobFS recording\n", path);
+		fclose(f);
+		return 0;
+	}
+
+	raw = (char*) malloc(header.entry_size);
+	capacity = 0;
+	*lost = 0;
+
+	while (raw != NULL && fread(raw, header.entry_size, 1, f) == 1)
+	{
+		memcpy(&entry, raw, sizeof(struct record_entry));
+
+		if (entry.op == RECORD_DROPPED)
+		{
+			*lost += entry.size;
+			continue;
+		}
+
+		if (entry.op >= OPS)
+		{
+			continue;
+		}
+
+		if (entry_count == capacity)
+		{
+			capacity = capacity ? 2 * capacity : 65536;
+			entries = (struct record_entry*) realloc(entries,
+				capacity * sizeof(struct record_entry));
+
+			if (entries == NULL)
+			{
+				break;
+			}
+		}
+
+		entries[entry_count++] = entry;
+	}
+
+	free(raw);
+	fclose(f);
+
+	if (raw == NULL || (capacity > 0 && entries == NULL))
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 0;
+	}
+
+	qsort(entries, entry_count, sizeof(struct record_entry), compare_entries);
+
+	return 1;
+}
+
+/**
+ * Prints results of operation op as a JSON object
+ */
+static void report(int op, double seconds)
+{
+	double *samples, recorded, sum, late, late_max;
+	unsigned long i, n, errors, mismatched;
+
+	samples = (double*) malloc((entry_count + 1) * sizeof(double));
+	if (samples == NULL)
+	{
+		return;
+	}
+
+	n = errors = mismatched = 0;
+	recorded = sum = late = late_max = 0;
+
+	for (i = 0; i < entry_count; i++)
+	{
+		if (entries[i].op != op)
+		{
+			continue;
+		}
+
+		samples[n++] = latencies[i];
+		sum += latencies[i];
+		recorded += entries[i].duration;
+		errors += entries[i].result < 0;
+		mismatched += mismatches[i];
+		late += lateness[i];
+
+		if (lateness[i] > late_max)
+		{
+			late_max = lateness[i];
+		}
+	}
+
+	if (n > 0)
+	{
+		qsort(samples, n, sizeof(double), compare_doubles);
+
+		printf("{\"workload\": \"replay\", \"op\": \"%s\", \"count\": %lu, \"ops_per_s\": %.1f, "
+			"\"mean_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"recorded_mean_us\": %.1f, "
+			"\"recorded_errors\": %lu, \"mismatched\": %lu, \"late_mean_us\": %.1f, "
+			"\"late_max_us\": %.1f}\n", op_names[op], n, n / seconds, sum / n,
+			samples[n / 2], samples[n * 99 / 100], recorded / n, errors, mismatched,
+			late / n, late_max);
+	}
+
+	free(samples);
+}
+
+/**
+ * Prints usage information
+ */
+static void usage(void)
+{
+	puts("Usage: myblobfs-replay [--speed=X] [--threads=N] [--shard-levels=N]\n"
+		"         [--shard-digits=N] [--shard-width=N] [--xattrs=NAME+...]\n"
+		"         RECORDING MOUNTPOINT\n"
+		"  --speed=X    replay X times faster than recorded; 0 replays as fast as\n"
+		"               possible (default: 1)\n"
+		"  --threads=N  number of replaying threads; operations of the same process\n"
+		"               always go to the same thread (default: one per process,\n"
+		"               at most 64)\n"
+		"  --shard-levels=N, --shard-digits=N, --shard-width=N\n"
+		"               shard layout the file system was mounted with (default:\n"
+		"               0, 2 and 10)\n"
+		"  --xattrs=NAME+...\n"
+		"               extended attribute names of the file system: user. followed\n"
+		"               by each of its --xattr-fields, then that of its checksum,\n"
+		"               if any");
+}
+
+/**
+ * Program entry point
+ */
+int main(int argc, char *argv[])
+{
+	struct player players[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	uint32_t pids[MAX_THREADS];
+	unsigned int threads_count, pid_count, i, t;
+	unsigned long j, lost;
+	const char *recording;
+	char *name;
+	double seconds;
+	int arg;
+
+	speed = 1;
+	threads_count = 0;
+	shard_digits = 2;
+	shard_width = 10;
+
+	for (arg = 1; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++)
+	{
+		if (strncmp(argv[arg], "--speed=", 8) == 0)
+		{
+			speed = atof(argv[arg] + 8);
+		}
+		else if (strncmp(argv[arg], "--threads=", 10) == 0)
+		{
+			threads_count = atoi(argv[arg] + 10);
+		}
+		else if (strncmp(argv[arg], "--shard-levels=", 15) == 0)
+		{
+			shard_levels = atoi(argv[arg] + 15);
+		}
+		else if (strncmp(argv[arg], "--shard-digits=", 15) == 0)
+		{
+			shard_digits = atoi(argv[arg] + 15);
+		}
+		else if (strncmp(argv[arg], "--shard-width=", 14) == 0)
+		{
+			shard_width = atoi(argv[arg] + 14);
+		}
+		else if (strncmp(argv[arg], "--xattrs=", 9) == 0)
+		{
+			for (name = strtok(argv[arg] + 9, "+"); name != NULL && xattr_count < MAX_XATTRS;
+				name = strtok(NULL, "+"))
+			{
+				xattr_names[xattr_count++] = name;
+			}
+		}
+		else
+		{
+			usage();
+			return 2;
+		}
+	}
+
+	if (argc - arg != 2 || speed < 0 || threads_count > MAX_THREADS ||
+		shard_width > 19 || shard_levels * shard_digits > shard_width)
+	{
+		usage();
+		return 2;
+	}
+
+	recording = argv[arg];
+	mount_point = argv[arg + 1];
+
+	if (!load(recording, &lost))
+	{
+		return 1;
+	}
+
+	if (entry_count == 0)
+	{
+		fprintf(stderr, "%s: No operations recorded\n", recording);
+		return 1;
+	}
+
+	latencies = (double*) calloc(entry_count, sizeof(double));
+	lateness = (double*) calloc(entry_count, sizeof(double));
+	mismatches = (char*) calloc(entry_count, 1);
+
+	if (latencies == NULL || lateness == NULL || mismatches == NULL)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	//
+	// Give every recorded process a thread of its own, as long as there are
+	// enough threads, so that concurrency of the original workload is kept
+	//
+
+	memset(players, 0, sizeof(players));
+	pid_count = 0;
+
+	for (j = 0; j < entry_count && pid_count < MAX_THREADS; j++)
+	{
+		for (i = 0; i < pid_count && pids[i] != entries[j].pid; i++);
+
+		if (i == pid_count)
+		{
+			pids[pid_count++] = entries[j].pid;
+		}
+	}
+
+	if (threads_count == 0)
+	{
+		threads_count = pid_count;
+	}
+
+	for (t = 0; t < threads_count; t++)
+	{
+		players[t].entries = (unsigned long*) malloc(entry_count * sizeof(unsigned long));
+		if (players[t].entries == NULL)
+		{
+			fprintf(stderr, "Out of memory\n");
+			return 1;
+		}
+
+		for (i = 0; i < OPEN_FILES; i++)
+		{
+			players[t].fds[i] = -1;
+		}
+	}
+
+	for (j = 0; j < entry_count; j++)
+	{
+		for (i = 0; i < pid_count && pids[i] != entries[j].pid; i++);
+
+		t = (i < pid_count ? i : entries[j].pid) % threads_count;
+		players[t].entries[players[t].count++] = j;
+	}
+
+	//
+	// Replay
+	//
+
+	clock_gettime(CLOCK_MONOTONIC, &replay_started);
+
+	for (t = 0; t < threads_count; t++)
+	{
+		if (pthread_create(&threads[t], NULL, play, &players[t]) != 0)
+		{
+			fprintf(stderr, "Unable to start replaying thread\n");
+			return 1;
+		}
+	}
+
+	for (t = 0; t < threads_count; t++)
+	{
+		pthread_join(threads[t], NULL);
+	}
+
+	seconds = elapsed_since(&replay_started) / 1e6;
+
+	if (lost > 0)
+	{
+		fprintf(stderr, "%s: %lu operations were not recorded\n", recording, lost);
+	}
+
+	for (i = 0; i < OPS; i++)
+	{
+		report(i, seconds);
+	}
+
+	return 0;
+}
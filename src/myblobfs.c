@@ -19,7 +19,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#define FUSE_USE_VERSION 25
+#define FUSE_USE_VERSION 26
 
 #include <stdio.h>
 #include <stddef.h>
@@ -30,7 +30,35 @@
 #include <fuse.h>
 #include <fuse_opt.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/un.h>
 #include <mysql/mysql.h>
+#include <zlib.h>
+#include "myblobfs-record.h"
+
+/**
+ * Static tracepoints (USDT), for bpftrace, perf and SystemTap. A probe is a
+ * single nop until a tracer attaches to it. Without <sys/sdt.h>, or with
+ * MYBLOBFS_NO_SDT defined, probes compile to nothing
+ */
+#if !defined(MYBLOBFS_NO_SDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MY_PROBE(...) STAP_PROBEV(myblobfs, __VA_ARGS__)
+#endif
+#endif
+
+#ifndef MY_PROBE
+#define MY_PROBE(...)
+#endif
 
 /**
  * Macro for short command-line options definition
@@ -62,6 +90,16 @@ struct options
 	 */
 	int rq_password;
 
+	/**
+	 * Whether the name field holds strings rather than integers
+	 */
+	int string_keys;
+
+	/**
+	 * Tables mounted as subdirectories, instead of table as the root
+	 */
+	char *tables;
+
 	/**
 	 * Database name
 	 */
@@ -81,6 +119,131 @@ struct options
 	 * Name of the field with file content
 	 */
 	char *data_field;
+
+	/**
+	 * Number of rows fetched in one pipelined round trip when a file is
+	 * opened (0 disables prefetching)
+	 */
+	unsigned int prefetch;
+
+	/**
+	 * Largest row size (in bytes) whose content is prefetched
+	 */
+	unsigned int prefetch_max_size;
+
+	/**
+	 * Row cache budget, in megabytes
+	 */
+	unsigned int cache_size;
+
+	/**
+	 * Number of seconds a cached row stays valid
+	 */
+	unsigned int cache_ttl;
+
+	/**
+	 * Comma-separated list of read replicas, as "host[:port]"
+	 */
+	char *replicas;
+
+	/**
+	 * Comma-separated list of servers rows are split across, as
+	 * "host[:port]", and the highest row name of every server but the last
+	 * if they are split by ranges
+	 */
+	char *servers;
+	char *server_bounds;
+
+	/**
+	 * Largest number of connections per server
+	 */
+	unsigned int pool_size;
+
+	/**
+	 * Number of connections per server reserved for metadata operations
+	 */
+	unsigned int reserved;
+
+	/**
+	 * Size of byte ranges large rows are read in, in bytes
+	 */
+	unsigned int stripe_size;
+
+	/**
+	 * Number of byte ranges fetched concurrently
+	 */
+	unsigned int stripes;
+
+	/**
+	 * Query timeouts for metadata operations, reads and prefetches, in
+	 * milliseconds
+	 */
+	unsigned int timeout_meta;
+	unsigned int timeout_read;
+	unsigned int timeout_prefetch;
+
+	/**
+	 * Unix socket Prometheus metrics are served on
+	 */
+	char *metrics_socket;
+
+	/**
+	 * File Prometheus metrics are periodically written to, and the period in
+	 * seconds
+	 */
+	char *metrics_file;
+	unsigned int metrics_interval;
+
+	/**
+	 * File SQL queries are traced to
+	 */
+	char *trace_file;
+
+	/**
+	 * Duration in milliseconds from which queries are always traced
+	 */
+	unsigned int trace_slow;
+
+	/**
+	 * Trace one query in this many regardless of duration (0 for none)
+	 */
+	unsigned int trace_sample;
+
+	/**
+	 * File operations are recorded to, for replay
+	 */
+	char *record;
+
+	/**
+	 * Number of directory levels rows are sharded into, digits of the row
+	 * name per level, and width row names are zero-padded to
+	 */
+	unsigned int shard_levels;
+	unsigned int shard_digits;
+	unsigned int shard_width;
+
+	/**
+	 * Number of row names per partition directory (0 if there are none)
+	 */
+	unsigned int partition_size;
+
+	/**
+	 * File defining filtered views
+	 */
+	char *views;
+
+	/**
+	 * Fields exposed as extended attributes, separated by pluses
+	 */
+	char *xattr_fields;
+
+	/**
+	 * Content checksum algorithm, field holding stored checksums, and name
+	 * of the extended attribute exposing them
+	 */
+	char *checksum;
+	char *checksum_field;
+	char *checksum_xattr;
 };
 
 /**
@@ -96,511 +259,7697 @@ static struct fuse_opt hello_opts[] =
 	MYBLOBFS_OPT_KEY("--table=%s",      table,       0),
 	MYBLOBFS_OPT_KEY("--name-field=%s", name_field,  0),
 	MYBLOBFS_OPT_KEY("--data-field=%s", data_field,  0),
+	MYBLOBFS_OPT_KEY("--string-keys",   string_keys, 1),
+	MYBLOBFS_OPT_KEY("--tables=%s",     tables,      0),
+	MYBLOBFS_OPT_KEY("--prefetch=%u",   prefetch,    0),
+	MYBLOBFS_OPT_KEY("--prefetch-max-size=%u", prefetch_max_size, 0),
+	MYBLOBFS_OPT_KEY("--cache-size=%u", cache_size,  0),
+	MYBLOBFS_OPT_KEY("--cache-ttl=%u",  cache_ttl,   0),
+	MYBLOBFS_OPT_KEY("--replicas=%s",   replicas,    0),
+	MYBLOBFS_OPT_KEY("--servers=%s",    servers,     0),
+	MYBLOBFS_OPT_KEY("--server-bounds=%s", server_bounds, 0),
+	MYBLOBFS_OPT_KEY("--pool-size=%u",  pool_size,   0),
+	MYBLOBFS_OPT_KEY("--reserved=%u",   reserved,    0),
+	MYBLOBFS_OPT_KEY("--stripe-size=%u", stripe_size, 0),
+	MYBLOBFS_OPT_KEY("--stripes=%u",    stripes,     0),
+	MYBLOBFS_OPT_KEY("--timeout-meta=%u", timeout_meta, 0),
+	MYBLOBFS_OPT_KEY("--timeout-read=%u", timeout_read, 0),
+	MYBLOBFS_OPT_KEY("--timeout-prefetch=%u", timeout_prefetch, 0),
+	MYBLOBFS_OPT_KEY("--metrics-socket=%s", metrics_socket, 0),
+	MYBLOBFS_OPT_KEY("--metrics-file=%s", metrics_file, 0),
+	MYBLOBFS_OPT_KEY("--metrics-interval=%u", metrics_interval, 0),
+	MYBLOBFS_OPT_KEY("--trace-file=%s", trace_file,  0),
+	MYBLOBFS_OPT_KEY("--trace-slow=%u", trace_slow,  0),
+	MYBLOBFS_OPT_KEY("--trace-sample=%u", trace_sample, 0),
+	MYBLOBFS_OPT_KEY("--record=%s",     record,      0),
+	MYBLOBFS_OPT_KEY("--shard-levels=%u", shard_levels, 0),
+	MYBLOBFS_OPT_KEY("--shard-digits=%u", shard_digits, 0),
+	MYBLOBFS_OPT_KEY("--shard-width=%u", shard_width, 0),
+	MYBLOBFS_OPT_KEY("--partition-size=%u", partition_size, 0),
+	MYBLOBFS_OPT_KEY("--views=%s",      views,       0),
+	MYBLOBFS_OPT_KEY("--xattr-fields=%s", xattr_fields, 0),
+	MYBLOBFS_OPT_KEY("--checksum=%s",   checksum,    0),
+	MYBLOBFS_OPT_KEY("--checksum-field=%s", checksum_field, 0),
+	MYBLOBFS_OPT_KEY("--checksum-xattr=%s", checksum_xattr, 0),
 
 	FUSE_OPT_END
 };
 
 /**
- * Table name
+ * Whether the name field holds strings rather than integers
  */
-static char *my_table;
+static my_bool my_string_keys;
 
 /**
- * Name of the field containing filename. Field must be declared as either: 
- * an integer or a string
+ * Largest number of fields exposed as extended attributes
  */
-static char *my_name_field;
+#define XATTRS_MAX 16
 
 /**
- * Name of the field with file contents. Field can be declared using any data
- * type from standard MySQL distribution
+ * Namespace extended attributes are exposed in, followed by the field name
  */
-static char *my_data_field;
+#define XATTR_PREFIX "user."
 
 /**
- * MySQL connection information
+ * Extended attribute content checksums are exposed as by default, followed
+ * by the algorithm name
  */
-static MYSQL mysql;
+#define CHECKSUM_XATTR_PREFIX "user.myblobfs."
 
 /**
- * Query pattern for fetching file names
+ * Fields exposed as extended attributes of every file, and the names of
+ * the attributes
  */
-static char *readdir_qp = "SELECT %s FROM %s ORDER BY %s";
+static char *my_xattr_fields[XATTRS_MAX];
+static char *my_xattr_names[XATTRS_MAX];
+static unsigned int my_xattr_count;
 
 /**
- * Query pattern for checking if file exists, getting its size and reading it
+ * Content checksum algorithm, with the expression computing a checksum of
+ * a field on the server
  */
-static char *read_qp = "SELECT %s FROM %s WHERE %s = %s";
+struct checksum_algorithm
+{
+	const char *name;
+	const char *expr;
+};
 
 /**
- * Function call pattern that returns file size
+ * Supported content checksum algorithms
  */
-static char *size_fp = "LENGTH(%s)";
+static const struct checksum_algorithm checksum_algorithms[] =
+{
+	{ "md5",    "MD5(%s)" },
+	{ "sha1",   "SHA1(%s)" },
+	{ "sha256", "SHA2(%s, 256)" },
+	{ "sha512", "SHA2(%s, 512)" },
+	{ NULL,     NULL }
+};
 
 /**
- * Returns if str consists only of one or more decimal digits
+ * Algorithm content checksums are computed with by the server (NULL if they
+ * are not, or if they are read from a field instead), and name of the
+ * extended attribute holding them
  */
-my_bool is_uint(const char *str)
-{
-	int i;
+static const struct checksum_algorithm *my_checksum;
+static char *my_checksum_xattr;
 
-	if (strlen(str) == 0)
-	{
-		return 0;
-	}
+/**
+ * Connection parameters shared by all endpoints
+ */
+static char *my_username, *my_password, *my_database;
 
-	for (i = 0; i < strlen(str); i++)
-	{
-		if (!isdigit(str[i]))
-		{
-			return 0;
-		}
-	}
+/**
+ * Query pattern for fetching file names
+ */
+static char *readdir_qp = "SELECT %s FROM %s ORDER BY %s";
 
-	return 1;
-}
+/**
+ * Query pattern for fetching file names within a range
+ */
+static char *range_qp = "SELECT %s FROM %s WHERE %s BETWEEN %s AND %s ORDER BY %s";
 
 /**
- * Returns if str is a valid MySQL identifier, which can be used without
- * being enclosed in hyphens
+ * Query pattern for fetching the lowest and highest file names
  */
-my_bool is_valid_ident(const char *str)
-{
-	int i;
+static char *bounds_qp = "SELECT MIN(%s), MAX(%s) FROM %s";
 
-	if (strlen(str) == 0)
-	{
-		return 0;
-	}
+/**
+ * Query patterns for fetching distinct values of a key field, and file names,
+ * of rows matching a key condition
+ */
+static char *level_qp = "SELECT DISTINCT %s FROM %s WHERE %s ORDER BY %s";
+static char *files_qp = "SELECT %s FROM %s WHERE %s ORDER BY %s";
 
-	for (i = 0; i < strlen(str); i++)
-	{
-		if (!isalnum(str[i]) && (str[i] != '_'))
-		{
-			return 0;
-		}
-	}
+/**
+ * Number of directory levels rows are sharded into (0 if all rows are in the
+ * root directory), digits of the row name per level, and width row names
+ * are zero-padded to
+ */
+static unsigned int my_shard_levels, my_shard_digits, my_shard_width;
 
-	return 1;
-}
+/**
+ * Directory holding partition directories, each listing a fixed range of
+ * row names
+ */
+#define PARTITION_DIR "/by-range"
 
 /**
- * Returns if path is a valid relative file or directory path. Valid paths
- * are: "/" (file system root directory) and "/id" (file representing record
- * with primary key "id", where "id" is an unsigned integer value)
+ * Number of row names per partition directory (0 if there are none)
  */
-my_bool is_valid_path(const char *path)
-{
-	if (strcmp(path, "/") == 0)
-	{
-		return 1;
-	}
+static unsigned int my_partition_size;
 
-	if (path[0] != '/')
-	{
-		return 0;
-	}
+/**
+ * Directory holding filtered views of a table, each listing the rows that
+ * match a condition
+ */
+#define VIEW_DIR "/views"
 
-	if (!is_uint(path + 1))
-	{
-		return 0;
-	}
+/**
+ * What a path refers to
+ */
+enum my_path_kind
+{
+	PATH_DIR,
+	PATH_FILE,
+	PATH_PARTITIONS,
+	PATH_TABLES,
+	PATH_VIEWS,
+	PATH_ROW
+};
 
-	return 1;
-}
+/**
+ * Size of the cache key of a row: directory of its table and a slash, if
+ * tables are mounted as subdirectories, followed by the row name, or by path
+ * of the row within the table if it has a composite key
+ */
+#define KEY_MAX (10 * (NAME_MAX + 1))
 
 /**
- * Returns stat info of the specified file
- *
- * TODO: For memory/connection errors use error code other than -ENOENT
+ * Resolved path
  */
-static int my_getattr(const char *path, struct stat *stbuf)
+struct my_path
 {
-	char *query, *filename, *my_data_field_size;
-	int result;
-	MYSQL_RES *res;
-	MYSQL_ROW row;
+	enum my_path_kind kind;
 
-	if (!is_valid_path(path))
-	{
-		return -ENOENT;
-	}
+	/**
+	 * Table the path is in (NULL for the root directory holding tables)
+	 */
+	const struct my_table *table;
 
-	memset(stbuf, 0, sizeof(struct stat));
+	/**
+	 * Cache key, row name and data field of a file. The row name points
+	 * into the key, which starts with the data field if the table has
+	 * several
+	 */
+	char key[KEY_MAX];
+	const char *name;
+	const char *column;
 
-	//
-	// Path points to the only directory, use its static attributes
-	//
+	/**
+	 * Whether the path is the root directory of its table
+	 */
+	my_bool root;
 
-	if (strcmp(path, "/") == 0)
-	{
-		stbuf->st_mode = S_IFDIR | 0555;
-		stbuf->st_nlink = 2;
-		stbuf->st_uid = getuid();
-		stbuf->st_gid = getgid();
-		return 0;
-	}
+	/**
+	 * Depth of a directory in the shard hierarchy, and the range of row
+	 * names it lists (all rows if it is not ranged)
+	 */
+	unsigned int depth;
+	my_bool ranged;
 
-	//
-	// Path points to one of the files, get its attributes from the database
-	//
+	/**
+	 * Whether the path is inside a partition directory
+	 */
+	my_bool partition;
+	unsigned long long lo, hi;
 
-	result = 0;
+	/**
+	 * View the path is inside (NULL if it is not in one)
+	 */
+	const struct my_view *view;
+};
 
-	filename = (char*) malloc(strlen(path) + 1);
-	if (filename != NULL)
-	{
-		strcpy(filename, path + 1);
+/**
+ * Query pattern for checking if file exists, getting its size and reading it
+ */
+static char *read_qp = "SELECT %s FROM %s WHERE %s";
 
-		//
-		// Query file size from the database
-		//
+/**
+ * Function call pattern that returns file size
+ */
+static char *size_fp = "LENGTH(%s)";
 
-		my_data_field_size = (char*) malloc(strlen(size_fp) + strlen(my_data_field) + 1);
+/**
+ * Statement pattern used for pipelined fetches. Several of these are sent to
+ * the server in one packet; each returns the row size and, if the row is not
+ * larger than the prefetch limit, its content
+ */
+static char *prefetch_sp = "SELECT LENGTH(%s), IF(LENGTH(%s) <= %s, %s, NULL)%s FROM %s WHERE %s;";
 
-		if (my_data_field_size != NULL)
-		{
-			sprintf(my_data_field_size, size_fp, my_data_field);
+/**
+ * FUSE operations statistics are kept for
+ */
+enum my_op
+{
+	OP_GETATTR,
+	OP_OPEN,
+	OP_READDIR,
+	OP_READ,
+	OP_GETXATTR,
+	OP_LISTXATTR,
+	MY_OPS
+};
 
-			query = (char*) malloc(strlen(read_qp) + strlen(my_data_field_size) + 
-					strlen(my_table) + strlen(my_name_field) + strlen(filename));
+/**
+ * Names of the operations, as shown in the statistics
+ */
+static const char *op_names[MY_OPS] =
+{
+	"getattr", "open", "readdir", "read", "getxattr", "listxattr"
+};
 
-			if (query != NULL)
-			{
-				sprintf(query, read_qp, my_data_field_size, my_table, my_name_field, filename);
-				mysql_real_query(&mysql, query, (unsigned int) strlen(query));
-				res = mysql_use_result(&mysql);
+/**
+ * Kinds of queries sent to the server
+ */
+enum my_query_kind
+{
+	QUERY_ATTR,
+	QUERY_EXISTS,
+	QUERY_LIST,
+	QUERY_FETCH,
+	QUERY_PIPELINE,
+	QUERY_STRIPE,
+	QUERY_RANGE,
+	QUERY_BOUNDS,
+	QUERY_LEVEL,
+	QUERY_FILES,
+	QUERY_CHECKSUM,
+	MY_QUERY_KINDS
+};
 
-				if (res != NULL)
-				{
+/**
+ * Names of the query kinds, as shown in the statistics
+ */
+static const char *query_names[MY_QUERY_KINDS] =
+{
+	"attr", "exists", "list", "fetch", "pipeline", "stripe", "range", "bounds",
+	"level", "files", "checksum"
+};
 
-					//
-					// If specified filename has a corresponding row in the
-					// database, return its information. Else, report that
-					// there is no such file
-					//
+/**
+ * Latency histogram resolution: every power of two is split into this many
+ * linear sub-buckets, which keeps relative error of recorded values within
+ * 1/16
+ */
+#define HIST_SUB 16
 
-					row = mysql_fetch_row(res);
+/**
+ * Number of histogram buckets, enough for latencies of up to 2^40 us
+ */
+#define HIST_BUCKETS (38 * HIST_SUB)
 
-					if (row != NULL)
-					{
-						stbuf->st_mode = S_IFREG | 0555;
-						stbuf->st_nlink = 1;
-						stbuf->st_size = atoi(row[0]);
-						stbuf->st_uid = getuid();
-						stbuf->st_gid = getgid();
-					}
-					else
-					{
-						result = -ENOENT;
-					}
- 
-					mysql_free_result(res);
-				}
-				else
-				{
-					result = -ENOENT;
-				}
+/**
+ * Log-linear latency histogram, values in microseconds
+ */
+struct stats_hist
+{
+	unsigned long count[HIST_BUCKETS];
+	unsigned long total, sum, max;
+};
 
-				free(query);
-			}
-			else
-			{
-				result = -ENOENT;
-			}
+/**
+ * Set of counters. Every thread updates its own shard without locking, and
+ * shards are summed up when statistics are read
+ */
+struct stats_shard
+{
+	/**
+	 * Latency of FUSE operations and their error counts
+	 */
+	struct stats_hist ops[MY_OPS];
+	unsigned long op_errors[MY_OPS];
 
-			free(my_data_field_size);
-		}
-		else
-		{
-			result = ENOENT;
-		}
+	/**
+	 * Latency of server queries, their error counts and bytes received
+	 */
+	struct stats_hist queries[MY_QUERY_KINDS];
+	unsigned long query_errors[MY_QUERY_KINDS];
+	unsigned long query_bytes[MY_QUERY_KINDS];
 
-		free(filename);
+	/**
+	 * Bytes returned to readers
+	 */
+	unsigned long bytes_served;
+
+	/**
+	 * Row cache lookups that found and did not find what they looked for
+	 */
+	unsigned long cache_hits, cache_misses;
+
+	/**
+	 * Whether a running thread owns the shard
+	 */
+	my_bool owned;
+
+	/**
+	 * Next shard
+	 */
+	struct stats_shard *next;
+};
+
+/**
+ * All shards ever allocated. Shards of exited threads are reused
+ */
+static struct stats_shard *stats_shards;
+
+/**
+ * Protects the list of shards
+ */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Shard of the current thread
+ */
+static __thread struct stats_shard *stats_local;
+
+/**
+ * Releases the shard of an exiting thread
+ */
+static pthread_key_t stats_key;
+
+/**
+ * Unix socket and file metrics are exported through (NULL if not used), and
+ * how often the file is rewritten, in seconds
+ */
+static char *my_metrics_socket, *my_metrics_file;
+static unsigned int my_metrics_interval;
+
+/**
+ * Hidden directory with virtual files and the statistics file inside it
+ */
+#define VFS_DIR "/.myblobfs"
+#define VFS_STATS VFS_DIR "/stats"
+#define VFS_CONTROL VFS_DIR "/control"
+
+/**
+ * Longest key recorded in the query trace
+ */
+#define TRACE_KEY_MAX 64
+
+/**
+ * Number of trace records that may wait for the writer
+ */
+#define TRACE_RING 4096
+
+/**
+ * Query trace record
+ */
+struct trace_record
+{
+	/**
+	 * Wall clock time the query completed
+	 */
+	struct timespec when;
+
+	/**
+	 * Server and server-side connection id the query ran on
+	 */
+	struct my_endpoint *endpoint;
+	unsigned long conn_id;
+
+	/**
+	 * Table, query kind and key (empty if the query has none)
+	 */
+	const struct my_table *table;
+	enum my_query_kind kind;
+	char key[TRACE_KEY_MAX];
+
+	/**
+	 * Duration in microseconds, rows and content bytes received
+	 */
+	unsigned long duration, rows, bytes;
+
+	/**
+	 * 0 on success or negated error code
+	 */
+	int status;
+};
+
+/**
+ * Trace file (NULL if tracing is off)
+ */
+static FILE *trace_file;
+
+/**
+ * Queries at least this many milliseconds long are always traced (0 if
+ * none are)
+ */
+static unsigned int trace_slow;
+
+/**
+ * One query in this many is traced regardless of its duration (0 if none is)
+ */
+static unsigned int trace_sample;
+
+/**
+ * Number of queries completed, for sampling
+ */
+static unsigned long trace_seq;
+
+/**
+ * Largest number of tables mounted at once
+ */
+#define TABLES_MAX 64
+
+/**
+ * Largest number of fields in a composite key
+ */
+#define KEY_FIELDS_MAX 8
+
+/**
+ * Largest number of data fields of a table
+ */
+#define COLUMNS_MAX 16
+
+/**
+ * Mounted table
+ */
+struct my_table
+{
+	/**
+	 * Table name
+	 */
+	char *table;
+
+	/**
+	 * Name of the field containing filename. Field must be declared as
+	 * either: an integer or a string
+	 */
+	char *name_field;
+
+	/**
+	 * Fields of a composite key: those directory levels are named after,
+	 * followed by the name field, and the number of directory levels (0 if
+	 * the name field is the whole key)
+	 */
+	char *fields[KEY_FIELDS_MAX];
+	unsigned int levels;
+
+	/**
+	 * Name of the field with file contents. Field can be declared using any
+	 * data type from standard MySQL distribution
+	 */
+	char *data_field;
+
+	/**
+	 * Data fields, the first of them being data_field. If there are
+	 * several, every row is a directory holding a file named after each
+	 */
+	char *columns[COLUMNS_MAX];
+	unsigned int column_count;
+
+	/**
+	 * Directory the table is mounted as, followed by a slash, which also
+	 * starts cache keys of its rows (empty if it is mounted as the root)
+	 */
+	char prefix[NAME_MAX + 2];
+
+	/**
+	 * Statement of every query kind with table and column names filled in,
+	 * so that only the key and other per-query values are left as
+	 * conversions, and statement template of every query kind for the
+	 * trace. Built once per mount
+	 */
+	char *formats[MY_QUERY_KINDS];
+	char *templates[MY_QUERY_KINDS];
+};
+
+/**
+ * Mounted tables
+ */
+static struct my_table my_tables[TABLES_MAX];
+static unsigned int my_table_count;
+
+/**
+ * Whether tables are mounted as subdirectories of the root, rather than a
+ * single table as the root itself
+ */
+static my_bool my_table_dirs;
+
+/**
+ * Largest number of views, over all tables
+ */
+#define VIEWS_MAX 256
+
+/**
+ * Filtered view: directory inside VIEW_DIR of its table, listing the rows
+ * for which condition, an SQL expression, holds. The condition is checked
+ * by the server, so that it can use the indexes of the table
+ */
+struct my_view
+{
+	const struct my_table *table;
+	char *name;
+	char *condition;
+};
+
+/**
+ * Views of all mounted tables
+ */
+static struct my_view my_views[VIEWS_MAX];
+static unsigned int my_view_count;
+
+/**
+ * Growable buffer, kept by a thread across requests
+ */
+struct my_buf
+{
+	char *data;
+	size_t size;
+};
+
+/**
+ * Query text and prefetch name list buffers of the current thread, so that
+ * requests do not allocate memory once they have grown large enough
+ */
+static __thread struct my_buf query_buf, names_buf;
+
+/**
+ * String row names quoted for queries, of the current thread
+ */
+static __thread struct my_buf key_buf;
+
+/**
+ * Extended attribute values packed for the cache, of the current thread
+ */
+static __thread struct my_buf xattrs_buf;
+
+/**
+ * Frees the buffers of an exiting thread
+ */
+static pthread_key_t buf_key;
+
+/**
+ * Smallest buffer allocated
+ */
+#define BUF_MIN 1024
+
+/**
+ * Records waiting for the writer: those between trace_head and trace_tail,
+ * modulo ring size
+ */
+static struct trace_record trace_ring[TRACE_RING];
+static unsigned long trace_head, trace_tail;
+
+/**
+ * Number of records dropped since the writer last ran
+ */
+static unsigned long trace_dropped;
+
+/**
+ * Protects the trace ring and wakes up the writer
+ */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t trace_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Number of recorded operations that may wait for the writer
+ */
+#define RECORD_RING 16384
+
+/**
+ * Operation recording (NULL if recording is off) and the time it started
+ */
+static FILE *record_file;
+static struct timespec record_started;
+
+/**
+ * Entries waiting for the writer: those between record_head and record_tail,
+ * modulo ring size
+ */
+static struct record_entry record_ring[RECORD_RING];
+static unsigned long record_head, record_tail;
+
+/**
+ * Number of entries dropped since the writer last ran
+ */
+static unsigned long record_dropped;
+
+/**
+ * Protects the recording ring and wakes up the writer
+ */
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t record_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Request classes, in order of priority. Metadata operations (getattr, open,
+ * readdir) have connections reserved for them, so that they never queue
+ * behind bulk reads; background prefetch gets the smallest share
+ */
+enum my_class
+{
+	MY_CLASS_META,
+	MY_CLASS_READ,
+	MY_CLASS_PREFETCH,
+	MY_CLASSES
+};
+
+/**
+ * Relative share of connections each class gets when several are waiting
+ */
+static const unsigned int sched_weights[MY_CLASSES] = { 8, 4, 1 };
+
+/**
+ * Server that queries can be sent to: the primary or one of its replicas
+ */
+struct my_endpoint
+{
+	/**
+	 * Host name (NULL for local server) and TCP/IP port
+	 */
+	char *host;
+	unsigned int port;
+
+	/**
+	 * Server whose rows the endpoint holds (0 unless rows are split across
+	 * servers)
+	 */
+	unsigned int server;
+
+	/**
+	 * Exponentially weighted moving average of query latency, microseconds
+	 */
+	double latency;
+
+	/**
+	 * Number of queries currently running on the endpoint, in total and per
+	 * request class
+	 */
+	unsigned int inflight;
+	unsigned int busy[MY_CLASSES];
+
+	/**
+	 * Number of connections currently open to the endpoint
+	 */
+	unsigned int open;
+
+	/**
+	 * Number of consecutive failures and total number of queries and failures
+	 */
+	unsigned int failures;
+	unsigned long queries, errors;
+
+	/**
+	 * Time until which the endpoint is not used after repeated failures, and
+	 * the length of the next such period
+	 */
+	time_t ejected_until;
+	unsigned int backoff;
+
+	/**
+	 * Idle connections to the endpoint
+	 */
+	struct my_conn *idle;
+
+	/**
+	 * Side connection used by the watchdog to kill queries
+	 */
+	MYSQL *killer;
+};
+
+/**
+ * FUSE request being served. Connections working for it, including those of
+ * stripe workers, point to it, so that interrupting the request cancels
+ * all of their queries
+ */
+struct my_request
+{
+	/**
+	 * Set from the signal handler when the kernel interrupts the request
+	 */
+	volatile sig_atomic_t interrupted;
+
+	/**
+	 * Number of connections in use for the request, changed with pool_lock
+	 * held. Interrupts arriving while there are none are ignored
+	 */
+	volatile sig_atomic_t conns;
+};
+
+/**
+ * Pooled MySQL connection
+ */
+struct my_conn
+{
+	/**
+	 * MySQL connection information
+	 */
+	MYSQL mysql;
+
+	/**
+	 * Endpoint the connection belongs to
+	 */
+	struct my_endpoint *endpoint;
+
+	/**
+	 * Time the connection was handed out
+	 */
+	struct timespec acquired;
+
+	/**
+	 * Request class the connection was handed out for
+	 */
+	enum my_class class;
+
+	/**
+	 * Whether the connection failed while in use
+	 */
+	my_bool failed;
+
+	/**
+	 * Time by which the running query must finish, if has_deadline is set
+	 */
+	struct timespec deadline;
+	my_bool has_deadline;
+
+	/**
+	 * Request the connection is used for
+	 */
+	struct my_request *request;
+
+	/**
+	 * 0, or -EINTR/-ETIMEDOUT if the running query has been killed
+	 */
+	int cancelled;
+
+	/**
+	 * Held while a KILL QUERY for the connection is being issued
+	 */
+	pthread_mutex_t kill_lock;
+
+	/**
+	 * Table, kind and start time of the running query, whether one is
+	 * running and whether it failed, and number of content bytes it returned
+	 */
+	const struct my_table *table;
+	enum my_query_kind kind;
+	struct timespec query_start;
+	my_bool querying, query_failed;
+	unsigned long received;
+
+	/**
+	 * Key the running query is for and number of rows it returned, for the
+	 * query trace
+	 */
+	char key[TRACE_KEY_MAX];
+	unsigned long rows;
+
+	/**
+	 * Next idle connection
+	 */
+	struct my_conn *next;
+
+	/**
+	 * Neighbours in the list of connections in use
+	 */
+	struct my_conn *busy_prev, *busy_next;
+};
+
+/**
+ * Maximal number of endpoints (primary and replicas)
+ */
+#define POOL_MAX_ENDPOINTS 16
+
+/**
+ * Number of consecutive failures after which an endpoint is ejected
+ */
+#define POOL_EJECT_FAILURES 3
+
+/**
+ * Longest ejection period, in seconds
+ */
+#define POOL_MAX_BACKOFF 60
+
+/**
+ * Endpoints queries are spread across. The first one is the primary
+ */
+static struct my_endpoint pool_endpoints[POOL_MAX_ENDPOINTS];
+
+/**
+ * Number of servers rows are split across by name, each holding a part of
+ * every table (1 if a single server, possibly with replicas, holds all of
+ * them)
+ */
+static unsigned int my_server_count;
+
+/**
+ * Whether rows are split across servers by ranges of their names rather
+ * than by hash, and the highest row name of every server but the last
+ */
+static my_bool my_server_ranges;
+static unsigned long long my_server_bounds[POOL_MAX_ENDPOINTS];
+
+/**
+ * Number of endpoints in use
+ */
+static unsigned int pool_count;
+
+/**
+ * Largest number of connections per endpoint
+ */
+static unsigned int pool_size;
+
+/**
+ * Protects endpoints and their idle lists
+ */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Signalled when a connection is returned to the pool
+ */
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Connections currently handed out
+ */
+static struct my_conn *pool_busy;
+
+/**
+ * Query timeout of each request class, in milliseconds (0 for none)
+ */
+static unsigned int sched_timeouts[MY_CLASSES];
+
+/**
+ * Request served by the current FUSE worker thread
+ */
+static __thread struct my_request my_served;
+
+/**
+ * Request the current thread works for: the one it serves, or the one a
+ * stripe worker fetches a stripe for, so that the interrupt signal handler
+ * can flag it
+ */
+static __thread struct my_request *my_current;
+
+/**
+ * How often the watchdog looks for queries to cancel, in milliseconds
+ */
+#define WATCHDOG_PERIOD 50
+
+/**
+ * Number of connections per endpoint that only metadata operations may use
+ */
+static unsigned int pool_reserved;
+
+/**
+ * Number of threads waiting for a connection of each server in each class
+ */
+static unsigned int sched_waiting[POOL_MAX_ENDPOINTS][MY_CLASSES];
+
+/**
+ * Virtual time of each class on each server for stride scheduling: grows by
+ * the inverse of the class weight each time the class gets a connection of
+ * the server. Servers rows are split across are scheduled independently
+ */
+static unsigned long sched_pass[POOL_MAX_ENDPOINTS][MY_CLASSES];
+
+/**
+ * Stride scheduling scale
+ */
+#define SCHED_STRIDE 840
+
+/**
+ * Number of rows fetched per pipelined round trip (0 if prefetch is off)
+ */
+static unsigned int my_prefetch;
+
+/**
+ * Largest row whose content is prefetched
+ */
+static unsigned int my_prefetch_max_size;
+
+/**
+ * Query pattern for fetching a byte range of a row
+ */
+static char *stripe_qp = "SELECT SUBSTRING(%s, %s, %s) FROM %s WHERE %s";
+
+/**
+ * Size of the cache key of a stripe: cache key of the row, "/" and stripe
+ * index. Row names never contain slashes, so stripe keys never clash with
+ * them
+ */
+#define STRIPE_KEY_MAX (KEY_MAX + 21)
+
+/**
+ * Size of byte ranges large rows are read in (0 reads rows as a whole) and
+ * number of ranges fetched concurrently
+ */
+static unsigned int my_stripe_size, my_stripes;
+
+/**
+ * Byte range of a row being fetched by one of the parallel workers
+ */
+struct my_stripe
+{
+	/**
+	 * Table and cache key of the row, and view it is read through, if any
+	 */
+	const struct my_table *table;
+	const char *name;
+	const struct my_view *view;
+
+	/**
+	 * Index of the stripe within the row and its expected length
+	 */
+	unsigned long long index;
+	unsigned long length;
+
+	/**
+	 * Received content and its length
+	 */
+	char *data;
+	unsigned long received;
+
+	/**
+	 * 0 on success or negated error code
+	 */
+	int result;
+
+	/**
+	 * Request the stripe is fetched for, whether it has been fetched, and
+	 * next stripe waiting for a worker
+	 */
+	struct my_request *request;
+	my_bool done;
+	struct my_stripe *next;
+};
+
+/**
+ * Stripes waiting for a worker, in the order they were handed out, and the
+ * link the next one is appended to
+ */
+static struct my_stripe *stripe_queue;
+static struct my_stripe **stripe_tail = &stripe_queue;
+
+/**
+ * Protects the stripe queue and the done flags of stripes, signalled when a
+ * stripe is queued and when one has been fetched
+ */
+static pthread_mutex_t stripe_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stripe_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t stripe_fetched = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Stripe worker threads, their number, and whether they are to exit
+ */
+static pthread_t *stripe_workers;
+static unsigned int stripe_worker_count;
+static my_bool stripe_stopping;
+
+/**
+ * Listing query run on one of the servers rows are split across, merged
+ * with the listings of the others by row name
+ */
+struct my_listing
+{
+	/**
+	 * Connection and unbuffered result of the query
+	 */
+	struct my_conn *conn;
+	MYSQL_RES *res;
+
+	/**
+	 * Current row (NULL once the result is exhausted) and whether it has
+	 * been returned, so that the next one is to be fetched
+	 */
+	MYSQL_ROW row;
+	my_bool consumed;
+
+	/**
+	 * 0 on success or negated error code
+	 */
+	int result;
+};
+
+/**
+ * Number of buckets in the row cache hash table
+ */
+#define CACHE_BUCKETS 4096
+
+/**
+ * Row cache entry. Holds the size of a row and, optionally, its content
+ */
+struct cache_entry
+{
+	/**
+	 * Value of the name field
+	 */
+	char *name;
+
+	/**
+	 * Row size in bytes
+	 */
+	unsigned long size;
+
+	/**
+	 * Row content or NULL, if only the size is known
+	 */
+	char *data;
+
+	/**
+	 * Values of the extended attribute fields, packed by xattrs_pack(), or
+	 * NULL if they are not known
+	 */
+	char *xattrs;
+	unsigned long xattrs_size;
+
+	/**
+	 * Content checksum computed by the server, or NULL if it is not known
+	 */
+	char *checksum;
+
+	/**
+	 * Time after which the entry is no longer valid
+	 */
+	time_t expires;
+
+	/**
+	 * Next entry in the same hash bucket
+	 */
+	struct cache_entry *hnext;
+
+	/**
+	 * Neighbours in the least-recently-used list
+	 */
+	struct cache_entry *prev, *next;
+};
+
+/**
+ * Row cache hash table
+ */
+static struct cache_entry *cache_table[CACHE_BUCKETS];
+
+/**
+ * Most and least recently used cache entries
+ */
+static struct cache_entry *cache_head, *cache_tail;
+
+/**
+ * Number of bytes currently held by the cache, counting every entry with its
+ * name, content, extended attributes and checksum, and its budget
+ */
+static unsigned long cache_used, cache_budget;
+
+/**
+ * Lifetime of cache entries, in seconds
+ */
+static unsigned int cache_ttl;
+
+/**
+ * Protects the row cache
+ */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Row names returned by the latest directory listing, in listing order. Used
+ * to guess which files will be opened next
+ */
+static unsigned long long *hint_names;
+
+/**
+ * Table the latest directory listing was of
+ */
+static const struct my_table *hint_table;
+
+/**
+ * Number of entries in hint_names
+ */
+static unsigned int hint_count;
+
+/**
+ * Protects hint_names, hint_table and hint_count
+ */
+static pthread_mutex_t hint_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Largest number of names remembered from a directory listing
+ */
+#define HINT_MAX 65536
+
+/**
+ * Number of names per block of the name index. Only the first name of a
+ * block is stored whole; every other one as the length of the prefix it
+ * shares with the name before it, followed by the rest of it
+ */
+#define NAME_BLOCK 16
+
+/**
+ * Sorted, front-coded set of string row names from the latest listing of the
+ * root directory. Answers lookups of missing files without a query, and
+ * tells which rows follow an opened one, for prefetching
+ */
+struct name_index
+{
+	/**
+	 * Encoded names, and offset of the first name of every block
+	 */
+	char *data;
+	size_t *blocks;
+
+	/**
+	 * Number of names
+	 */
+	unsigned long count;
+
+	/**
+	 * Table the names are of, and time the index was built
+	 */
+	const struct my_table *table;
+	time_t built;
+};
+
+/**
+ * Position in the name index, and the name found there
+ */
+struct name_cursor
+{
+	const struct name_index *index;
+	unsigned long pos;
+	size_t offset;
+	char name[NAME_MAX + 1];
+};
+
+/**
+ * Current name index (NULL if there is none yet), and the lock protecting it
+ */
+static struct name_index *name_index;
+static pthread_mutex_t name_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Open virtual file: snapshot of its content or, if the control file is open
+ * for writing, the command line written so far
+ */
+struct vfs_file
+{
+	my_bool writing;
+	char *text;
+};
+
+/**
+ * Longest command line and largest number of words in it accepted by the
+ * control file
+ */
+#define CONTROL_LINE_MAX 4096
+#define CONTROL_WORDS 256
+
+/**
+ * Setting that can be changed through the control file
+ */
+struct control_setting
+{
+	const char *name;
+	unsigned int *value;
+};
+
+/**
+ * Settings changed through the control file by simply storing the new value,
+ * atomically, as it is read without a lock. Code deriving more than one thing
+ * from a setting reads it once. Cache and pool sizes are handled separately,
+ * as changing them takes more
+ */
+static struct control_setting control_settings[] =
+{
+	{"cache-ttl",         &cache_ttl},
+	{"prefetch",          &my_prefetch},
+	{"prefetch-max-size", &my_prefetch_max_size},
+	{"timeout-meta",      &sched_timeouts[MY_CLASS_META]},
+	{"timeout-read",      &sched_timeouts[MY_CLASS_READ]},
+	{"timeout-prefetch",  &sched_timeouts[MY_CLASS_PREFETCH]},
+	{"trace-slow",        &trace_slow},
+	{"trace-sample",      &trace_sample},
+	{NULL, NULL}
+};
+
+/**
+ * Returns if str consists only of one or more decimal digits
+ */
+my_bool is_uint(const char *str)
+{
+	int i;
+
+	if (strlen(str) == 0)
+	{
+		return 0;
+	}
+
+	for (i = 0; i < strlen(str); i++)
+	{
+		if (!isdigit(str[i]))
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Returns if str is a valid MySQL identifier, which can be used without
+ * being enclosed in hyphens
+ */
+my_bool is_valid_ident(const char *str)
+{
+	int i;
+
+	if (strlen(str) == 0)
+	{
+		return 0;
+	}
+
+	for (i = 0; i < strlen(str); i++)
+	{
+		if (!isalnum(str[i]) && (str[i] != '_'))
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Returns if name may be a row name: digits only for integer names, anything
+ * but slashes for string ones. Either way, it must fit into a file name
+ */
+static my_bool is_valid_key(const char *name)
+{
+	if (strlen(name) > NAME_MAX)
+	{
+		return 0;
+	}
+
+	if (my_string_keys)
+	{
+		return name[0] != '\0' && strchr(name, '/') == NULL;
+	}
+
+	return is_uint(name);
+}
+
+/**
+ * Returns 10 raised to the power of n
+ */
+static unsigned long long pow10_ull(unsigned int n)
+{
+	unsigned long long result;
+
+	for (result = 1; n > 0; n--)
+	{
+		result *= 10;
+	}
+
+	return result;
+}
+
+/**
+ * Returns if the first len characters of str are decimal digits
+ */
+static my_bool is_digits(const char *str, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		if (!isdigit(str[i]))
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Makes p refer to the file of row name in its table
+ */
+static void path_key(struct my_path *p, const char *name)
+{
+	p->kind = PATH_FILE;
+	sprintf(p->key, "%s%s", p->table->prefix, name);
+	p->name = p->key + strlen(p->table->prefix);
+}
+
+/**
+ * Resolves path inside the partition directory into p: "" (the directory
+ * itself), "/lo-hi" (partition listing row names from lo to hi) or
+ * "/lo-hi/id" (file of a row within that range). Returns if it is valid
+ */
+static my_bool partition_resolve(const char *path, struct my_path *p)
+{
+	const char *c;
+	char *end;
+
+	if (*path == '\0')
+	{
+		p->kind = PATH_PARTITIONS;
+		return 1;
+	}
+
+	//
+	// Partition name must be an exact range, starting at a multiple of the
+	// partition size
+	//
+
+	c = path + 1;
+
+	if (!isdigit(*c))
+	{
+		return 0;
+	}
+
+	p->lo = strtoull(c, &end, 10);
+
+	if (*end != '-' || !isdigit(end[1]))
+	{
+		return 0;
+	}
+
+	p->hi = strtoull(end + 1, &end, 10);
+
+	if ((*end != '\0' && *end != '/') || p->lo % my_partition_size != 0 ||
+		p->hi != p->lo + my_partition_size - 1)
+	{
+		return 0;
+	}
+
+	p->kind = PATH_DIR;
+	p->ranged = 1;
+	p->partition = 1;
+
+	if (*end == '\0')
+	{
+		return 1;
+	}
+
+	//
+	// File inside the partition
+	//
+
+	c = end + 1;
+
+	if (!is_uint(c) || strlen(c) > NAME_MAX || strtoull(c, NULL, 10) < p->lo ||
+		strtoull(c, NULL, 10) > p->hi)
+	{
+		return 0;
+	}
+
+	while (*c == '0' && c[1] != '\0')
+	{
+		c++;
+	}
+
+	path_key(p, c);
+
+	return 1;
+}
+
+/**
+ * Returns if table has any views
+ */
+static my_bool table_has_views(const struct my_table *table)
+{
+	unsigned int i;
+
+	for (i = 0; i < my_view_count; i++)
+	{
+		if (my_views[i].table == table)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Resolves path inside the view directory of a table into p: "" (the
+ * directory itself), "/view" (rows of the view) or "/view/id" (file of a row
+ * of the view). Returns if it is valid. Whether the row matches the view is
+ * left to the queries on it
+ */
+static my_bool view_resolve(const char *path, struct my_path *p)
+{
+	const char *name;
+	unsigned int i;
+	size_t len;
+
+	if (*path == '\0')
+	{
+		p->kind = PATH_VIEWS;
+		return 1;
+	}
+
+	name = path + 1;
+	len = strcspn(name, "/");
+
+	for (i = 0; i < my_view_count; i++)
+	{
+		if (my_views[i].table == p->table && strlen(my_views[i].name) == len &&
+			strncmp(my_views[i].name, name, len) == 0)
+		{
+			p->view = &my_views[i];
+			break;
+		}
+	}
+
+	if (p->view == NULL)
+	{
+		return 0;
+	}
+
+	if (name[len] == '\0')
+	{
+		return 1;
+	}
+
+	if (!is_valid_key(name + len + 1))
+	{
+		return 0;
+	}
+
+	path_key(p, name + len + 1);
+
+	return 1;
+}
+
+/**
+ * Returns the number of directory levels name has, if every one of them and
+ * its last component are valid names, or -1 otherwise
+ */
+static int key_depth(const char *name)
+{
+	char component[NAME_MAX + 1];
+	const char *slash;
+	int depth;
+	size_t len;
+
+	for (depth = 0; ; depth++, name = slash + 1)
+	{
+		slash = strchr(name, '/');
+		len = slash != NULL ? (size_t) (slash - name) : strlen(name);
+
+		if (len > NAME_MAX)
+		{
+			return -1;
+		}
+
+		memcpy(component, name, len);
+		component[len] = '\0';
+
+		if (!is_valid_key(component))
+		{
+			return -1;
+		}
+
+		if (slash == NULL)
+		{
+			return depth;
+		}
+	}
+}
+
+/**
+ * Returns if name may be a row name of table: one valid name per key field,
+ * separated by slashes
+ */
+static my_bool is_valid_row(const struct my_table *table, const char *name)
+{
+	return key_depth(name) == (int) table->levels;
+}
+
+/**
+ * Returns the server holding row name, if rows are split across servers:
+ * by the remainder of the integer name divided by the number of servers, or
+ * of its CRC-32 for string names, the same as the MOD() and CRC32() SQL
+ * functions compute, or by the range the name is in
+ */
+static unsigned int key_server(const char *name)
+{
+	unsigned long long id;
+	unsigned int i;
+
+	if (my_server_count <= 1)
+	{
+		return 0;
+	}
+
+	if (my_string_keys)
+	{
+		return crc32(0L, (const Bytef*) name, strlen(name)) % my_server_count;
+	}
+
+	id = strtoull(name, NULL, 10);
+
+	if (!my_server_ranges)
+	{
+		return id % my_server_count;
+	}
+
+	for (i = 0; i + 1 < my_server_count && id > my_server_bounds[i]; i++);
+
+	return i;
+}
+
+/**
+ * Splits cache key of a file of table into the row name, which is returned,
+ * and its data field, stored in *column. Returns NULL if the key names no
+ * data field of a table with several
+ */
+static const char *key_split(const struct my_table *table, const char *key,
+	const char **column)
+{
+	unsigned int i;
+	size_t len;
+
+	key += strlen(table->prefix);
+	*column = table->data_field;
+
+	if (table->column_count == 1)
+	{
+		return key;
+	}
+
+	len = strcspn(key, "/");
+
+	for (i = 0; i < table->column_count; i++)
+	{
+		if (strlen(table->columns[i]) == len && strncmp(table->columns[i], key, len) == 0 &&
+			key[len] == '/')
+		{
+			*column = table->columns[i];
+			return key + len + 1;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Resolves path within the directory of a table with a composite key into
+ * p. Every key field but the last is a directory level, named after its
+ * values, so "/a/b" is a directory listing the values of the second key
+ * field in rows whose first is a, and "/a/b/c" with three key fields is the
+ * file of the row whose key is (a, b, c). Returns if it is valid
+ */
+static my_bool composite_resolve(const char *path, struct my_path *p)
+{
+	int depth;
+
+	depth = key_depth(path + 1);
+
+	if (depth < 0 || depth > (int) p->table->levels ||
+		strlen(p->table->prefix) + strlen(path + 1) >= KEY_MAX)
+	{
+		return 0;
+	}
+
+	if (depth == (int) p->table->levels)
+	{
+		path_key(p, path + 1);
+		return 1;
+	}
+
+	sprintf(p->key, "%s%s", p->table->prefix, path + 1);
+	p->name = p->key + strlen(p->table->prefix);
+	p->depth = depth + 1;
+
+	return 1;
+}
+
+/**
+ * Resolves path within the directory of its table into p. Returns if it is a
+ * valid relative file or directory path. Valid paths are: "/" (directory
+ * of the table) and "/id" (file
+ * representing record with primary key "id", where "id" is an unsigned
+ * integer value, or any string without slashes if names are strings).
+ *
+ * With a sharded layout, rows live in nested directories instead: every
+ * directory name holds the next shard_digits digits of the row name,
+ * zero-padded to shard_width, and the file name is the whole padded row
+ * name, e.g. "/00/12/0012345678". The file name alone identifies the row; the
+ * directories it is in only have to match it. Tables with a composite key
+ * are resolved by composite_resolve(), views by view_resolve()
+ */
+static my_bool table_resolve(const char *path, struct my_path *p)
+{
+	const char *c, *slash;
+	unsigned long long prefix;
+	unsigned int depth;
+	char digits[24];
+	size_t len;
+
+	p->ranged = my_shard_levels > 0;
+	p->hi = pow10_ull(my_shard_width) - 1;
+	p->root = strcmp(path, "/") == 0;
+
+	if (p->root)
+	{
+		return 1;
+	}
+
+	if (my_partition_size > 0 && strncmp(path, PARTITION_DIR, strlen(PARTITION_DIR)) == 0 &&
+		(path[strlen(PARTITION_DIR)] == '\0' || path[strlen(PARTITION_DIR)] == '/'))
+	{
+		return partition_resolve(path + strlen(PARTITION_DIR), p);
+	}
+
+	if (strncmp(path, VIEW_DIR, strlen(VIEW_DIR)) == 0 &&
+		(path[strlen(VIEW_DIR)] == '\0' || path[strlen(VIEW_DIR)] == '/') &&
+		table_has_views(p->table))
+	{
+		return view_resolve(path + strlen(VIEW_DIR), p);
+	}
+
+	if (p->table->levels > 0)
+	{
+		return composite_resolve(path, p);
+	}
+
+	if (my_shard_levels == 0)
+	{
+		if (!is_valid_key(path + 1))
+		{
+			return 0;
+		}
+
+		path_key(p, path + 1);
+		return 1;
+	}
+
+	//
+	// Walk shard directories, collecting the prefix they stand for, up to
+	// the file name, if there is one
+	//
+
+	prefix = 0;
+	depth = 0;
+
+	for (c = path + 1; ; c = slash + 1)
+	{
+		slash = strchr(c, '/');
+		len = slash != NULL ? (size_t) (slash - c) : strlen(c);
+
+		if (len == 0 || !is_digits(c, len))
+		{
+			return 0;
+		}
+
+		if (depth == my_shard_levels)
+		{
+			break;
+		}
+
+		if (len != my_shard_digits)
+		{
+			return 0;
+		}
+
+		prefix = prefix * pow10_ull(my_shard_digits) + strtoull(c, NULL, 10);
+		depth++;
+
+		if (slash == NULL)
+		{
+			p->depth = depth;
+			p->lo = prefix * pow10_ull(my_shard_width - depth * my_shard_digits);
+			p->hi = p->lo + pow10_ull(my_shard_width - depth * my_shard_digits) - 1;
+			return 1;
+		}
+	}
+
+	//
+	// File: its padded name must start with the prefix of its directories
+	//
+
+	if (slash != NULL || len != my_shard_width)
+	{
+		return 0;
+	}
+
+	sprintf(digits, "%0*llu", (int) (my_shard_levels * my_shard_digits), prefix);
+
+	if (strncmp(c, digits, my_shard_levels * my_shard_digits) != 0)
+	{
+		return 0;
+	}
+
+	while (*c == '0' && c[1] != '\0')
+	{
+		c++;
+	}
+
+	path_key(p, c);
+
+	return 1;
+}
+
+/**
+ * Makes p refer to the root directory of table
+ */
+static void path_init(struct my_path *p, const struct my_table *table)
+{
+	p->kind = PATH_DIR;
+	p->table = table;
+	p->key[0] = '\0';
+	p->name = p->key;
+	p->column = NULL;
+	p->root = 0;
+	p->depth = 0;
+	p->ranged = 0;
+	p->partition = 0;
+	p->lo = p->hi = 0;
+	p->view = NULL;
+}
+
+/**
+ * Resolves path within the directory of its table into p, like
+ * table_resolve(). If the table has several data fields, every row is a
+ * directory instead, holding a file named after each of them, e.g.
+ * "/42/thumbnail"
+ */
+static my_bool row_resolve(const char *path, struct my_path *p)
+{
+	char dir[KEY_MAX];
+	const char *slash, *column;
+	unsigned int i;
+	size_t len;
+
+	p->column = p->table->data_field;
+
+	if (p->table->column_count == 1)
+	{
+		return table_resolve(path, p);
+	}
+
+	if (table_resolve(path, p))
+	{
+		if (p->kind == PATH_FILE)
+		{
+			p->kind = PATH_ROW;
+		}
+
+		return 1;
+	}
+
+	//
+	// Otherwise the last component has to be a data field, of a row
+	//
+
+	slash = strrchr(path, '/');
+	len = slash - path;
+
+	if (len == 0 || len >= KEY_MAX)
+	{
+		return 0;
+	}
+
+	column = NULL;
+
+	for (i = 0; i < p->table->column_count; i++)
+	{
+		if (strcmp(p->table->columns[i], slash + 1) == 0)
+		{
+			column = p->table->columns[i];
+		}
+	}
+
+	if (column == NULL)
+	{
+		return 0;
+	}
+
+	memcpy(dir, path, len);
+	dir[len] = '\0';
+
+	path_init(p, p->table);
+	p->column = column;
+
+	if (!table_resolve(dir, p) || p->kind != PATH_FILE ||
+		strlen(p->key) + strlen(p->column) + 1 >= KEY_MAX)
+	{
+		return 0;
+	}
+
+	strcpy(dir, p->name);
+	sprintf(p->key, "%s%s/%s", p->table->prefix, p->column, dir);
+	p->name = p->key + strlen(p->table->prefix) + strlen(p->column) + 1;
+
+	return 1;
+}
+
+/**
+ * Resolves path into p. Returns if it is a valid relative file or directory
+ * path. If tables are mounted as subdirectories, the root directory lists
+ * them and paths inside "/table" resolve within that table
+ */
+static my_bool path_resolve(const char *path, struct my_path *p)
+{
+	unsigned int i;
+	size_t len;
+
+	if (path[0] != '/')
+	{
+		return 0;
+	}
+
+	path_init(p, &my_tables[0]);
+
+	if (!my_table_dirs)
+	{
+		return row_resolve(path, p);
+	}
+
+	if (strcmp(path, "/") == 0)
+	{
+		p->kind = PATH_TABLES;
+		p->table = NULL;
+		return 1;
+	}
+
+	len = strcspn(path + 1, "/");
+
+	for (i = 0; i < my_table_count; i++)
+	{
+		if (strlen(my_tables[i].table) == len &&
+			strncmp(path + 1, my_tables[i].table, len) == 0)
+		{
+			p->table = &my_tables[i];
+			return row_resolve(path[len + 1] == '\0' ? "/" : path + len + 1, p);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Marks shard of an exiting thread as free for reuse
+ */
+static void stats_release(void *shard)
+{
+	pthread_mutex_lock(&stats_lock);
+	((struct stats_shard*) shard)->owned = 0;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+/**
+ * Returns shard of the current thread, taking a free one or allocating a new
+ * one on first use. Returns NULL if out of memory
+ */
+static struct stats_shard *stats_shard(void)
+{
+	struct stats_shard *shard;
+
+	if (stats_local != NULL)
+	{
+		return stats_local;
+	}
+
+	pthread_mutex_lock(&stats_lock);
+
+	for (shard = stats_shards; shard != NULL && shard->owned; shard = shard->next);
+
+	if (shard == NULL)
+	{
+		shard = (struct stats_shard*) calloc(1, sizeof(struct stats_shard));
+		if (shard != NULL)
+		{
+			shard->next = stats_shards;
+			stats_shards = shard;
+		}
+	}
+
+	if (shard != NULL)
+	{
+		shard->owned = 1;
+		pthread_setspecific(stats_key, shard);
+	}
+
+	pthread_mutex_unlock(&stats_lock);
+
+	stats_local = shard;
+
+	return shard;
+}
+
+/**
+ * Returns histogram bucket for value
+ */
+static unsigned int hist_bucket(unsigned long value)
+{
+	unsigned int e, bucket;
+
+	if (value < HIST_SUB)
+	{
+		return value;
+	}
+
+	e = 8 * sizeof(unsigned long) - 1 - __builtin_clzl(value);
+	bucket = (e - 3) * HIST_SUB + ((value >> (e - 4)) & (HIST_SUB - 1));
+
+	return bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1;
+}
+
+/**
+ * Returns the smallest value that falls into bucket
+ */
+static unsigned long hist_value(unsigned int bucket)
+{
+	if (bucket < HIST_SUB)
+	{
+		return bucket;
+	}
+
+	return (unsigned long) (HIST_SUB + bucket % HIST_SUB) << (bucket / HIST_SUB - 1);
+}
+
+/**
+ * Records value in the histogram
+ */
+static void hist_record(struct stats_hist *hist, unsigned long value)
+{
+	hist->count[hist_bucket(value)]++;
+	hist->total++;
+	hist->sum += value;
+
+	if (value > hist->max)
+	{
+		hist->max = value;
+	}
+}
+
+/**
+ * Adds histogram src to dst
+ */
+static void hist_merge(struct stats_hist *dst, const struct stats_hist *src)
+{
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+	{
+		dst->count[i] += src->count[i];
+	}
+
+	dst->total += src->total;
+	dst->sum += src->sum;
+
+	if (src->max > dst->max)
+	{
+		dst->max = src->max;
+	}
+}
+
+/**
+ * Returns value below which fraction q of recorded values lie
+ */
+static unsigned long hist_quantile(const struct stats_hist *hist, double q)
+{
+	unsigned long rank, seen;
+	unsigned int i;
+
+	if (hist->total == 0)
+	{
+		return 0;
+	}
+
+	rank = (unsigned long) (q * hist->total);
+	if (rank >= hist->total)
+	{
+		rank = hist->total - 1;
+	}
+
+	seen = 0;
+	for (i = 0; i < HIST_BUCKETS; i++)
+	{
+		seen += hist->count[i];
+		if (seen > rank)
+		{
+			break;
+		}
+	}
+
+	return hist_value(i) < hist->max ? hist_value(i) : hist->max;
+}
+
+/**
+ * Returns microseconds elapsed since start
+ */
+static unsigned long stats_elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000000UL + now.tv_nsec / 1000 - start->tv_nsec / 1000;
+}
+
+/**
+ * Records completion of a FUSE operation that started at start
+ */
+static void stats_op(enum my_op op, const struct timespec *start, int result)
+{
+	struct stats_shard *shard = stats_shard();
+
+	if (shard == NULL)
+	{
+		return;
+	}
+
+	hist_record(&shard->ops[op], stats_elapsed(start));
+
+	if (result < 0)
+	{
+		shard->op_errors[op]++;
+	}
+	else if (op == OP_READ)
+	{
+		shard->bytes_served += result;
+	}
+}
+
+/**
+ * Records a cache lookup
+ */
+static void stats_cache(my_bool hit)
+{
+	struct stats_shard *shard = stats_shard();
+
+	if (shard != NULL)
+	{
+		if (hit)
+		{
+			shard->cache_hits++;
+		}
+		else
+		{
+			shard->cache_misses++;
+		}
+	}
+}
+
+/**
+ * Sums up all shards into total
+ */
+static void stats_collect(struct stats_shard *total)
+{
+	struct stats_shard *shard;
+	unsigned int i;
+
+	memset(total, 0, sizeof(struct stats_shard));
+
+	pthread_mutex_lock(&stats_lock);
+
+	for (shard = stats_shards; shard != NULL; shard = shard->next)
+	{
+		for (i = 0; i < MY_OPS; i++)
+		{
+			hist_merge(&total->ops[i], &shard->ops[i]);
+			total->op_errors[i] += shard->op_errors[i];
+		}
+
+		for (i = 0; i < MY_QUERY_KINDS; i++)
+		{
+			hist_merge(&total->queries[i], &shard->queries[i]);
+			total->query_errors[i] += shard->query_errors[i];
+			total->query_bytes[i] += shard->query_bytes[i];
+		}
+
+		total->bytes_served += shard->bytes_served;
+		total->cache_hits += shard->cache_hits;
+		total->cache_misses += shard->cache_misses;
+	}
+
+	pthread_mutex_unlock(&stats_lock);
+}
+
+/**
+ * Appends a line describing histogram to the text at p, returning the end
+ * of the appended text
+ */
+static char *stats_format_hist(char *p, const char *kind, const char *name,
+	const struct stats_hist *hist, unsigned long errors)
+{
+	return p + sprintf(p, "%s %s count %lu errors %lu mean %lu p50 %lu p90 %lu "
+		"p99 %lu p999 %lu max %lu\n", kind, name, hist->total, errors,
+		hist->total ? hist->sum / hist->total : 0,
+		hist_quantile(hist, 0.5), hist_quantile(hist, 0.9),
+		hist_quantile(hist, 0.99), hist_quantile(hist, 0.999), hist->max);
+}
+
+/**
+ * Returns current statistics as newly allocated text, or NULL if out of
+ * memory. Latencies are in microseconds
+ */
+static char *stats_format(void)
+{
+	struct stats_shard *total;
+	struct rusage usage;
+	unsigned long fetched;
+	char *text, *p;
+	unsigned int i;
+
+	total = (struct stats_shard*) malloc(sizeof(struct stats_shard));
+	text = (char*) malloc(256 * (MY_OPS + MY_QUERY_KINDS + 10));
+
+	if (total == NULL || text == NULL)
+	{
+		free(total);
+		free(text);
+		return NULL;
+	}
+
+	stats_collect(total);
+
+	p = text;
+	fetched = 0;
+
+	for (i = 0; i < MY_OPS; i++)
+	{
+		p = stats_format_hist(p, "op", op_names[i], &total->ops[i], total->op_errors[i]);
+	}
+
+	for (i = 0; i < MY_QUERY_KINDS; i++)
+	{
+		p = stats_format_hist(p, "query", query_names[i], &total->queries[i],
+			total->query_errors[i]);
+		fetched += total->query_bytes[i];
+	}
+
+	p += sprintf(p, "bytes served %lu\n", total->bytes_served);
+	p += sprintf(p, "bytes fetched %lu\n", fetched);
+	p += sprintf(p, "cache hits %lu\n", total->cache_hits);
+	p += sprintf(p, "cache misses %lu\n", total->cache_misses);
+
+	//
+	// CPU time used by the whole process, in microseconds
+	//
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	p += sprintf(p, "cpu user %lu\n",
+		(unsigned long) usage.ru_utime.tv_sec * 1000000 + usage.ru_utime.tv_usec);
+	p += sprintf(p, "cpu system %lu\n",
+		(unsigned long) usage.ru_stime.tv_sec * 1000000 + usage.ru_stime.tv_usec);
+
+	free(total);
+
+	return text;
+}
+
+/**
+ * Finds value of extended attribute field index in packed xattrs. Returns
+ * its length, storing where it starts in *value, or ULONG_MAX if it is NULL
+ */
+static unsigned long xattrs_value(const char *xattrs, unsigned int index, const char **value)
+{
+	unsigned long len;
+	unsigned int i;
+
+	for (i = 0; ; i++)
+	{
+		memcpy(&len, xattrs, sizeof(unsigned long));
+		xattrs += sizeof(unsigned long);
+
+		if (i == index)
+		{
+			*value = xattrs;
+			return len;
+		}
+
+		if (len != ULONG_MAX)
+		{
+			xattrs += len;
+		}
+	}
+}
+
+/**
+ * Returns hash bucket index for the specified row name
+ */
+static unsigned int cache_hash(const char *name)
+{
+	unsigned int h = 5381;
+
+	while (*name)
+	{
+		h = h * 33 + (unsigned char) *name++;
+	}
+
+	return h % CACHE_BUCKETS;
+}
+
+/**
+ * Returns the number of bytes entry takes up, as charged to the budget
+ */
+static unsigned long cache_footprint(const struct cache_entry *e)
+{
+	return sizeof(struct cache_entry) + strlen(e->name) + 1 +
+		(e->data != NULL ? e->size : 0) + (e->xattrs != NULL ? e->xattrs_size : 0) +
+		(e->checksum != NULL ? strlen(e->checksum) + 1 : 0);
+}
+
+/**
+ * Takes entry out of the LRU list. Must be called with cache_lock held
+ */
+static void cache_unlink(struct cache_entry *e)
+{
+	if (e->prev != NULL)
+	{
+		e->prev->next = e->next;
+	}
+	else
+	{
+		cache_head = e->next;
+	}
+
+	if (e->next != NULL)
+	{
+		e->next->prev = e->prev;
+	}
+	else
+	{
+		cache_tail = e->prev;
+	}
+}
+
+/**
+ * Unlinks entry from the hash table and the LRU list and frees it. Must be
+ * called with cache_lock held
+ */
+static void cache_remove(struct cache_entry *e)
+{
+	struct cache_entry **pp;
+
+	for (pp = &cache_table[cache_hash(e->name)]; *pp != e; pp = &(*pp)->hnext);
+	*pp = e->hnext;
+
+	cache_unlink(e);
+
+	cache_used -= cache_footprint(e);
+
+	free(e->data);
+	free(e->xattrs);
+	free(e->checksum);
+	free(e);
+}
+
+/**
+ * Returns the valid cache entry for name, moving it to the head of the LRU
+ * list, or NULL if there is none. Must be called with cache_lock held
+ */
+static struct cache_entry *cache_find(const char *name)
+{
+	struct cache_entry *e;
+
+	MY_PROBE(cache_lookup, name);
+
+	for (e = cache_table[cache_hash(name)]; e != NULL; e = e->hnext)
+	{
+		if (strcmp(e->name, name) == 0)
+		{
+			break;
+		}
+	}
+
+	if (e == NULL)
+	{
+		return NULL;
+	}
+
+	//
+	// Expired entries are left for cache_store() to refresh in place, or
+	// for eviction
+	//
+
+	if (e->expires < time(NULL))
+	{
+		MY_PROBE(cache_expire, name, e->size);
+		return NULL;
+	}
+
+	if (e != cache_head)
+	{
+		e->prev->next = e->next;
+
+		if (e->next != NULL)
+		{
+			e->next->prev = e->prev;
+		}
+		else
+		{
+			cache_tail = e->prev;
+		}
+
+		e->prev = NULL;
+		e->next = cache_head;
+		cache_head->prev = e;
+		cache_head = e;
+	}
+
+	return e;
+}
+
+/**
+ * Stores size and, if data is not NULL, content of a row in the cache,
+ * evicting least recently used entries to stay within the budget. An entry
+ * already held for the row is refreshed in place, reusing its buffers where
+ * they fit, so refreshing a row does not allocate memory. Extended
+ * attributes are stored if xattrs is not NULL, or kept from the entry being
+ * replaced otherwise, along with its expiry time. So is its checksum. Both
+ * are only kept if the row has not changed: it has the same size and, if
+ * content is stored, the same content as cached before
+ */
+static void cache_store(const char *name, unsigned long size, const char *data,
+	const char *xattrs, unsigned long xattrs_size)
+{
+	struct cache_entry *e;
+	unsigned int h;
+	my_bool same, carried;
+	time_t now;
+
+	if (data != NULL && size > cache_budget)
+	{
+		data = NULL;
+	}
+
+	now = time(NULL);
+	h = cache_hash(name);
+
+	pthread_mutex_lock(&cache_lock);
+
+	//
+	// Refresh the entry of the row in place, even an expired one, so that
+	// its memory is reused. New entries hold the name in the same block
+	//
+
+	for (e = cache_table[h]; e != NULL && strcmp(e->name, name) != 0; e = e->hnext);
+
+	if (e != NULL)
+	{
+		cache_unlink(e);
+		cache_used -= cache_footprint(e);
+
+		same = e->expires >= now && e->size == size && (data == NULL ||
+			(e->data != NULL && memcmp(e->data, data, size) == 0));
+	}
+	else
+	{
+		e = (struct cache_entry*) malloc(sizeof(struct cache_entry) + strlen(name) + 1);
+		if (e == NULL)
+		{
+			pthread_mutex_unlock(&cache_lock);
+			return;
+		}
+
+		memset(e, 0, sizeof(struct cache_entry));
+		e->name = (char*) (e + 1);
+		strcpy(e->name, name);
+
+		e->hnext = cache_table[h];
+		cache_table[h] = e;
+
+		same = 0;
+	}
+
+	carried = same && ((xattrs == NULL && e->xattrs != NULL) || e->checksum != NULL);
+
+	//
+	// Content buffer of the same size is reused
+	//
+
+	if (e->data != NULL && (data == NULL || e->size != size))
+	{
+		free(e->data);
+		e->data = NULL;
+	}
+
+	if (data != NULL)
+	{
+		if (e->data == NULL)
+		{
+			e->data = (char*) malloc(size + 1);
+		}
+
+		if (e->data != NULL)
+		{
+			memcpy(e->data, data, size);
+		}
+	}
+
+	//
+	// Extended attributes are replaced if given, or else kept, along with
+	// the checksum, only if the row has not changed
+	//
+
+	if (e->xattrs != NULL && (xattrs != NULL ? e->xattrs_size != xattrs_size : !same))
+	{
+		free(e->xattrs);
+		e->xattrs = NULL;
+		e->xattrs_size = 0;
+	}
+
+	if (xattrs != NULL)
+	{
+		if (e->xattrs == NULL)
+		{
+			e->xattrs = (char*) malloc(xattrs_size);
+		}
+
+		if (e->xattrs != NULL)
+		{
+			memcpy(e->xattrs, xattrs, xattrs_size);
+			e->xattrs_size = xattrs_size;
+		}
+	}
+
+	if (!same)
+	{
+		free(e->checksum);
+		e->checksum = NULL;
+	}
+
+	e->size = size;
+
+	if (!carried)
+	{
+		e->expires = now + cache_ttl;
+	}
+
+	//
+	// Put the entry at the head, then reap expired entries from the tail
+	// and evict least recently used ones to stay within the budget
+	//
+
+	cache_used += cache_footprint(e);
+
+	e->prev = NULL;
+	e->next = cache_head;
+	if (cache_head != NULL)
+	{
+		cache_head->prev = e;
+	}
+	else
+	{
+		cache_tail = e;
+	}
+	cache_head = e;
+
+	while (cache_tail != e && (cache_tail->expires < now || cache_used > cache_budget))
+	{
+		if (cache_tail->expires < now)
+		{
+			MY_PROBE(cache_expire, cache_tail->name, cache_tail->size);
+		}
+		else
+		{
+			MY_PROBE(cache_evict, cache_tail->name, cache_tail->size);
+		}
+
+		cache_remove(cache_tail);
+	}
+
+	MY_PROBE(cache_store, name, size, e->data != NULL, cache_used);
+
+	pthread_mutex_unlock(&cache_lock);
+}
+
+/**
+ * Sets the cache budget, evicting least recently used entries to stay
+ * within it
+ */
+static void cache_resize(unsigned long budget)
+{
+	pthread_mutex_lock(&cache_lock);
+
+	cache_budget = budget;
+
+	while (cache_used > cache_budget && cache_tail != NULL)
+	{
+		MY_PROBE(cache_evict, cache_tail->name, cache_tail->size);
+		cache_remove(cache_tail);
+	}
+
+	pthread_mutex_unlock(&cache_lock);
+}
+
+/**
+ * Removes row name and its stripes from the cache, or every entry if name is
+ * NULL
+ */
+static void cache_drop(const char *name)
+{
+	struct cache_entry *e, *next;
+	size_t len;
+
+	len = name != NULL ? strlen(name) : 0;
+
+	pthread_mutex_lock(&cache_lock);
+
+	for (e = cache_head; e != NULL; e = next)
+	{
+		next = e->next;
+
+		if (name == NULL || (strncmp(e->name, name, len) == 0 &&
+			(e->name[len] == '\0' || e->name[len] == '/')))
+		{
+			cache_remove(e);
+		}
+	}
+
+	pthread_mutex_unlock(&cache_lock);
+}
+
+/**
+ * Looks up row size in the cache, only if its extended attributes are known
+ * as well when there are any. Returns if it was found
+ */
+static my_bool cache_get_attr(const char *name, unsigned long *size)
+{
+	struct cache_entry *e;
+
+	pthread_mutex_lock(&cache_lock);
+
+	e = cache_find(name);
+	if (e != NULL && my_xattr_count > 0 && e->xattrs == NULL)
+	{
+		e = NULL;
+	}
+
+	if (e != NULL)
+	{
+		*size = e->size;
+		MY_PROBE(cache_hit, name, e->size);
+	}
+	else
+	{
+		MY_PROBE(cache_miss, name);
+	}
+
+	pthread_mutex_unlock(&cache_lock);
+
+	stats_cache(e != NULL);
+
+	return e != NULL;
+}
+
+/**
+ * Returns a copy of the packed extended attributes of a row in the cache,
+ * with their size in *size, or NULL if they are not there. The copy is to
+ * be freed by the caller
+ */
+static char *cache_get_xattrs(const char *name, unsigned long *size)
+{
+	struct cache_entry *e;
+	char *xattrs;
+
+	xattrs = NULL;
+
+	pthread_mutex_lock(&cache_lock);
+
+	e = cache_find(name);
+	if (e != NULL && e->xattrs != NULL && (xattrs = (char*) malloc(e->xattrs_size)) != NULL)
+	{
+		memcpy(xattrs, e->xattrs, e->xattrs_size);
+		*size = e->xattrs_size;
+	}
+
+	pthread_mutex_unlock(&cache_lock);
+
+	return xattrs;
+}
+
+/**
+ * Stores content checksum of a row in the cache, if the row is there
+ */
+static void cache_set_checksum(const char *name, const char *checksum)
+{
+	struct cache_entry *e;
+	char *copy;
+
+	if ((copy = strdup(checksum)) == NULL)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&cache_lock);
+
+	e = cache_find(name);
+	if (e != NULL)
+	{
+		cache_used -= cache_footprint(e);
+		free(e->checksum);
+		e->checksum = copy;
+		copy = NULL;
+		cache_used += cache_footprint(e);
+	}
+
+	pthread_mutex_unlock(&cache_lock);
+
+	free(copy);
+}
+
+/**
+ * Returns a copy of the content checksum of a row in the cache, to be freed
+ * by the caller, or NULL if it is not there
+ */
+static char *cache_get_checksum(const char *name)
+{
+	struct cache_entry *e;
+	char *checksum;
+
+	checksum = NULL;
+
+	pthread_mutex_lock(&cache_lock);
+
+	e = cache_find(name);
+	if (e != NULL && e->checksum != NULL)
+	{
+		checksum = strdup(e->checksum);
+	}
+
+	pthread_mutex_unlock(&cache_lock);
+
+	return checksum;
+}
+
+/**
+ * Looks up row size in the cache. Returns if it was found
+ */
+static my_bool cache_get_size(const char *name, unsigned long *size)
+{
+	struct cache_entry *e;
+
+	pthread_mutex_lock(&cache_lock);
+
+	e = cache_find(name);
+	if (e != NULL)
+	{
+		*size = e->size;
+		MY_PROBE(cache_hit, name, e->size);
+	}
+	else
+	{
+		MY_PROBE(cache_miss, name);
+	}
+
+	pthread_mutex_unlock(&cache_lock);
+
+	stats_cache(e != NULL);
+
+	return e != NULL;
+}
+
+/**
+ * Returns if the cache holds everything prefetching would fetch for row
+ * name: its size, and its content unless it is too large to be prefetched
+ */
+static my_bool cache_covers(const char *name)
+{
+	struct cache_entry *e;
+	my_bool covered;
+
+	pthread_mutex_lock(&cache_lock);
+
+	e = cache_find(name);
+	covered = e != NULL && (e->data != NULL || e->size > my_prefetch_max_size);
+
+	pthread_mutex_unlock(&cache_lock);
+
+	return covered;
+}
+
+/**
+ * Copies up to size bytes of cached row content starting from offset into buf.
+ * Returns number of bytes copied or -1 if row content is not cached
+ */
+static int cache_read(const char *name, char *buf, size_t size, off_t offset)
+{
+	struct cache_entry *e;
+	int result;
+
+	pthread_mutex_lock(&cache_lock);
+
+	e = cache_find(name);
+	if (e != NULL && e->data != NULL)
+	{
+		if (offset < e->size)
+		{
+			if (offset + size > e->size)
+			{
+				size = e->size - offset;
+			}
+
+			memcpy(buf, e->data + offset, size);
+			result = size;
+		}
+		else
+		{
+			result = 0;
+		}
+	}
+	else
+	{
+		result = -1;
+	}
+
+	if (result >= 0)
+	{
+		MY_PROBE(cache_hit, name, result);
+	}
+	else
+	{
+		MY_PROBE(cache_miss, name);
+	}
+
+	pthread_mutex_unlock(&cache_lock);
+
+	stats_cache(result >= 0);
+
+	return result;
+}
+
+/**
+ * Appends name to the *count row names of the directory listing being read,
+ * held at *names with room for *capacity of them, growing it as needed
+ */
+static void hint_add(unsigned long long **names, unsigned int *count,
+	unsigned int *capacity, const char *name)
+{
+	unsigned long long *grown;
+
+	if (*count == *capacity)
+	{
+		if (*capacity == HINT_MAX)
+		{
+			return;
+		}
+
+		grown = (unsigned long long*) realloc(*names,
+			(*capacity ? *capacity * 2 : 1024) * sizeof(unsigned long long));
+
+		if (grown == NULL)
+		{
+			return;
+		}
+
+		*names = grown;
+		*capacity = *capacity ? *capacity * 2 : 1024;
+	}
+
+	(*names)[(*count)++] = strtoull(name, NULL, 10);
+}
+
+/**
+ * Makes count row names of a listing of table, in listing order, the
+ * prefetch hints, taking over the names array
+ */
+static void hint_set(const struct my_table *table, unsigned long long *names,
+	unsigned int count)
+{
+	unsigned long long *old;
+
+	pthread_mutex_lock(&hint_lock);
+
+	old = hint_names;
+	hint_names = names;
+	hint_count = count;
+	hint_table = table;
+
+	pthread_mutex_unlock(&hint_lock);
+
+	free(old);
+}
+
+/**
+ * Orders pointers to names by the names
+ */
+static int name_compare(const void *a, const void *b)
+{
+	return strcmp(*(const char**) a, *(const char**) b);
+}
+
+/**
+ * Decodes the name at the cursor into cursor->name and moves past it.
+ * Returns 0 at the end of the index
+ */
+static my_bool name_next(struct name_cursor *cursor)
+{
+	const char *s;
+	unsigned int shared;
+
+	if (cursor->pos >= cursor->index->count)
+	{
+		return 0;
+	}
+
+	s = cursor->index->data + cursor->offset;
+
+	if (cursor->pos % NAME_BLOCK == 0)
+	{
+		strcpy(cursor->name, s);
+		cursor->offset += strlen(s) + 1;
+	}
+	else
+	{
+		shared = (unsigned char) *s++;
+		strcpy(cursor->name + shared, s);
+		cursor->offset += strlen(s) + 2;
+	}
+
+	cursor->pos++;
+
+	return 1;
+}
+
+/**
+ * Moves the cursor past the first name of index that is not less than name.
+ * Returns if that name is equal to name
+ */
+static my_bool name_seek(struct name_cursor *cursor, const struct name_index *index,
+	const char *name)
+{
+	unsigned long lo, hi, mid;
+
+	//
+	// Find the last block whose first name is not greater than name, then
+	// decode names of the block
+	//
+
+	lo = 0;
+	hi = (index->count + NAME_BLOCK - 1) / NAME_BLOCK;
+
+	while (hi - lo > 1)
+	{
+		mid = lo + (hi - lo) / 2;
+
+		if (strcmp(index->data + index->blocks[mid], name) <= 0)
+		{
+			lo = mid;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	cursor->index = index;
+	cursor->pos = lo * NAME_BLOCK;
+	cursor->offset = index->count > 0 ? index->blocks[lo] : 0;
+
+	while (name_next(cursor))
+	{
+		if (strcmp(cursor->name, name) >= 0)
+		{
+			return strcmp(cursor->name, name) == 0;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Replaces the name index with one of count names of table, stored one after
+ * another in names, size bytes in total
+ */
+static void name_index_build(const struct my_table *table, const char *names, size_t size,
+	unsigned long count)
+{
+	struct name_index *index, *old;
+	const char **sorted;
+	unsigned long i;
+	size_t pos, shared, len;
+
+	index = (struct name_index*) malloc(sizeof(struct name_index));
+	sorted = (const char**) malloc((count + 1) * sizeof(char*));
+
+	if (index != NULL)
+	{
+		index->data = (char*) malloc(size + count + 1);
+		index->blocks = (size_t*) malloc((count / NAME_BLOCK + 1) * sizeof(size_t));
+	}
+
+	if (index == NULL || sorted == NULL || index->data == NULL || index->blocks == NULL)
+	{
+		if (index != NULL)
+		{
+			free(index->data);
+			free(index->blocks);
+		}
+
+		free(index);
+		free(sorted);
+		return;
+	}
+
+	//
+	// Sort the names and store every one of them as the part that differs
+	// from the one before
+	//
+
+	for (i = 0, pos = 0; i < count; i++)
+	{
+		sorted[i] = names + pos;
+		pos += strlen(names + pos) + 1;
+	}
+
+	qsort(sorted, count, sizeof(char*), name_compare);
+
+	for (i = 0, pos = 0; i < count; i++)
+	{
+		if (i % NAME_BLOCK == 0)
+		{
+			index->blocks[i / NAME_BLOCK] = pos;
+			shared = 0;
+		}
+		else
+		{
+			for (shared = 0; sorted[i][shared] != '\0' &&
+				sorted[i][shared] == sorted[i - 1][shared]; shared++);
+
+			index->data[pos++] = (char) shared;
+		}
+
+		len = strlen(sorted[i] + shared) + 1;
+		memcpy(index->data + pos, sorted[i] + shared, len);
+		pos += len;
+	}
+
+	free(sorted);
+
+	index->count = count;
+	index->table = table;
+	index->built = time(NULL);
+
+	pthread_mutex_lock(&name_lock);
+	old = name_index;
+	name_index = index;
+	pthread_mutex_unlock(&name_lock);
+
+	if (old != NULL)
+	{
+		free(old->data);
+		free(old->blocks);
+		free(old);
+	}
+}
+
+/**
+ * Appends name to the names collected from a listing for the name index,
+ * which are *length bytes long in a buffer of *size bytes. On failure, frees
+ * them and leaves *names NULL, so that collecting stops
+ */
+static void name_collect(char **names, size_t *length, size_t *size, const char *name)
+{
+	char *grown;
+	size_t len;
+
+	if (*names == NULL)
+	{
+		return;
+	}
+
+	len = strlen(name) + 1;
+
+	if (*length + len > *size)
+	{
+		grown = (char*) realloc(*names, 2 * *size + len);
+		if (grown == NULL)
+		{
+			free(*names);
+			*names = NULL;
+			return;
+		}
+
+		*names = grown;
+		*size = 2 * *size + len;
+	}
+
+	memcpy(*names + *length, name, len);
+	*length += len;
+}
+
+/**
+ * Returns if the name index lists row name of table (1) or not (0), or -1 if
+ * the index is of another table, missing or older than cache_ttl
+ */
+static int name_lookup(const struct my_table *table, const char *name)
+{
+	struct name_cursor cursor;
+	int result;
+
+	pthread_mutex_lock(&name_lock);
+
+	if (name_index == NULL || name_index->table != table ||
+		time(NULL) >= name_index->built + cache_ttl)
+	{
+		result = -1;
+	}
+	else
+	{
+		result = name_seek(&cursor, name_index, name);
+	}
+
+	pthread_mutex_unlock(&name_lock);
+
+	return result;
+}
+
+/**
+ * Adds endpoint given as "host[:port]" to the pool, holding rows of server.
+ * Returns if it was added
+ */
+static my_bool pool_add_endpoint(const char *spec, unsigned int default_port,
+	unsigned int server)
+{
+	struct my_endpoint *ep;
+	const char *colon;
+
+	if (pool_count == POOL_MAX_ENDPOINTS)
+	{
+		return 0;
+	}
+
+	ep = &pool_endpoints[pool_count];
+	memset(ep, 0, sizeof(struct my_endpoint));
+	ep->port = default_port;
+	ep->server = server;
+
+	if (spec != NULL)
+	{
+		colon = strchr(spec, ':');
+
+		ep->host = (char*) malloc(strlen(spec) + 1);
+		if (ep->host == NULL)
+		{
+			return 0;
+		}
+
+		strcpy(ep->host, spec);
+
+		if (colon != NULL)
+		{
+			ep->host[colon - spec] = '\0';
+
+			if (!is_uint(colon + 1))
+			{
+				free(ep->host);
+				return 0;
+			}
+
+			ep->port = atoi(colon + 1);
+		}
+	}
+
+	pool_count++;
+
+	return 1;
+}
+
+/**
+ * Opens a new connection to the endpoint. Returns NULL on failure
+ */
+static struct my_conn *pool_connect(struct my_endpoint *ep)
+{
+	struct my_conn *conn;
+
+	conn = (struct my_conn*) malloc(sizeof(struct my_conn));
+	if (conn == NULL)
+	{
+		return NULL;
+	}
+
+	memset(conn, 0, sizeof(struct my_conn));
+	conn->endpoint = ep;
+	pthread_mutex_init(&conn->kill_lock, NULL);
+
+	mysql_init(&conn->mysql);
+	if (mysql_real_connect(&conn->mysql, ep->host, my_username, my_password,
+		my_database, ep->port, NULL, CLIENT_MULTI_STATEMENTS) == NULL)
+	{
+		puts(mysql_error(&conn->mysql));
+		mysql_close(&conn->mysql);
+		pthread_mutex_destroy(&conn->kill_lock);
+		free(conn);
+		return NULL;
+	}
+
+	return conn;
+}
+
+/**
+ * Records a failure of the endpoint, ejecting it after several in a row.
+ * Must be called with pool_lock held
+ */
+static void pool_fail(struct my_endpoint *ep)
+{
+	ep->errors++;
+	ep->failures++;
+
+	if (ep->failures >= POOL_EJECT_FAILURES)
+	{
+		ep->backoff = ep->backoff ? ep->backoff * 2 : 1;
+		if (ep->backoff > POOL_MAX_BACKOFF)
+		{
+			ep->backoff = POOL_MAX_BACKOFF;
+		}
+
+		ep->ejected_until = time(NULL) + ep->backoff;
+		ep->failures = 0;
+	}
+}
+
+/**
+ * Returns if a connection of the endpoint may be handed out for the class.
+ * Reads and prefetches leave reserved connections to metadata operations,
+ * and prefetches may take at most half of what is left
+ */
+static my_bool pool_allows(struct my_endpoint *ep, enum my_class class)
+{
+	unsigned int bulk, limit;
+
+	if (ep->inflight >= pool_size)
+	{
+		return 0;
+	}
+
+	if (class == MY_CLASS_META)
+	{
+		return 1;
+	}
+
+	bulk = ep->busy[MY_CLASS_READ] + ep->busy[MY_CLASS_PREFETCH];
+	limit = pool_size - pool_reserved;
+
+	if (bulk >= limit)
+	{
+		return 0;
+	}
+
+	if (class == MY_CLASS_PREFETCH && ep->busy[MY_CLASS_PREFETCH] >= (limit > 1 ? limit / 2 : 1))
+	{
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Picks the endpoint of server for the next query of the class: the healthy
+ * one with the lowest latency, weighted by the number of queries already
+ * running on it, among those that have a connection the class may use.
+ * Ejected endpoints are only used if no other is available. Must be called
+ * with pool_lock held
+ */
+static struct my_endpoint *pool_pick(enum my_class class, unsigned int server)
+{
+	struct my_endpoint *ep, *best, *fallback;
+	double score, best_score;
+	time_t now;
+	unsigned int i;
+
+	now = time(NULL);
+	best = fallback = NULL;
+	best_score = 0;
+
+	for (i = 0; i < pool_count; i++)
+	{
+		ep = &pool_endpoints[i];
+
+		if (ep->server != server || !pool_allows(ep, class))
+		{
+			continue;
+		}
+
+		score = ep->latency * (ep->inflight + 1);
+
+		if (ep->ejected_until > now)
+		{
+			if (fallback == NULL || ep->ejected_until < fallback->ejected_until)
+			{
+				fallback = ep;
+			}
+		}
+		else if (best == NULL || score < best_score)
+		{
+			best = ep;
+			best_score = score;
+		}
+	}
+
+	return best != NULL ? best : fallback;
+}
+
+/**
+ * Returns if a waiting thread of the class may take a connection of server
+ * now: no other class that is waiting for the server is behind it in
+ * virtual time. Must be called with pool_lock held
+ */
+static my_bool sched_turn(enum my_class class, unsigned int server)
+{
+	int c;
+
+	for (c = 0; c < MY_CLASSES; c++)
+	{
+		if (c != class && sched_waiting[server][c] > 0 &&
+			sched_pass[server][c] < sched_pass[server][class] && pool_pick(c, server) != NULL)
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Takes a connection to server from the pool for a request of the class,
+ * opening a new one if needed. Waits while the class has no connection
+ * available or while other classes are owed their weighted share. Returns
+ * NULL if no endpoint can be reached
+ */
+static struct my_conn *pool_acquire(enum my_class class, unsigned int server)
+{
+	struct my_endpoint *ep;
+	struct my_conn *conn;
+	unsigned int attempts, timeout;
+	unsigned long floor;
+	int c;
+
+	pthread_mutex_lock(&pool_lock);
+
+	//
+	// A class that had nobody waiting must not use up the share it did
+	// not claim meanwhile, so it catches up with the busiest waiting class
+	//
+
+	if (sched_waiting[server][class] == 0)
+	{
+		floor = 0;
+		for (c = 0; c < MY_CLASSES; c++)
+		{
+			if (sched_waiting[server][c] > 0 && (floor == 0 || sched_pass[server][c] < floor))
+			{
+				floor = sched_pass[server][c];
+			}
+		}
+
+		if (sched_pass[server][class] < floor)
+		{
+			sched_pass[server][class] = floor;
+		}
+	}
+
+	sched_waiting[server][class]++;
+
+	for (attempts = 0; attempts < pool_count * POOL_EJECT_FAILURES; )
+	{
+		ep = pool_pick(class, server);
+
+		if (ep == NULL || !sched_turn(class, server))
+		{
+			pthread_cond_wait(&pool_cond, &pool_lock);
+			continue;
+		}
+
+		ep->inflight++;
+		ep->busy[class]++;
+
+		if (ep->idle != NULL)
+		{
+			conn = ep->idle;
+			ep->idle = conn->next;
+		}
+		else
+		{
+			//
+			// Connect without holding the lock, so that other threads
+			// keep using the pool meanwhile
+			//
+
+			ep->open++;
+			pthread_mutex_unlock(&pool_lock);
+			conn = pool_connect(ep);
+			pthread_mutex_lock(&pool_lock);
+
+			if (conn == NULL)
+			{
+				ep->open--;
+				ep->inflight--;
+				ep->busy[class]--;
+				pool_fail(ep);
+				pthread_cond_broadcast(&pool_cond);
+				attempts++;
+				continue;
+			}
+		}
+
+		sched_waiting[server][class]--;
+		sched_pass[server][class] += SCHED_STRIDE / sched_weights[class];
+
+		//
+		// Register the connection with the watchdog
+		//
+
+		conn->class = class;
+		conn->failed = 0;
+		conn->cancelled = 0;
+		conn->next = NULL;
+		clock_gettime(CLOCK_MONOTONIC, &conn->acquired);
+
+		timeout = __atomic_load_n(&sched_timeouts[class], __ATOMIC_RELAXED);
+		conn->has_deadline = timeout > 0;
+		if (conn->has_deadline)
+		{
+			conn->deadline.tv_sec = conn->acquired.tv_sec + timeout / 1000;
+			conn->deadline.tv_nsec = conn->acquired.tv_nsec + (timeout % 1000) * 1000000L;
+
+			if (conn->deadline.tv_nsec >= 1000000000L)
+			{
+				conn->deadline.tv_sec++;
+				conn->deadline.tv_nsec -= 1000000000L;
+			}
+		}
+
+		conn->busy_prev = NULL;
+		conn->busy_next = pool_busy;
+		if (pool_busy != NULL)
+		{
+			pool_busy->busy_prev = conn;
+		}
+		pool_busy = conn;
+
+		//
+		// Tie the connection to the request it works for. An interrupt left
+		// over from an earlier request of the thread does not count
+		//
+
+		if (my_current == NULL)
+		{
+			my_current = &my_served;
+		}
+
+		if (my_current->conns++ == 0)
+		{
+			my_current->interrupted = 0;
+		}
+
+		conn->request = my_current;
+
+		//
+		// Taking the connection may have made it another class' turn
+		//
+
+		pthread_cond_broadcast(&pool_cond);
+		pthread_mutex_unlock(&pool_lock);
+
+		return conn;
+	}
+
+	sched_waiting[server][class]--;
+	pthread_cond_broadcast(&pool_cond);
+
+	pthread_mutex_unlock(&pool_lock);
+
+	return NULL;
+}
+
+/**
+ * Builds the statement format and the trace template of every query kind for
+ * table t. Returns if it succeeded
+ */
+static my_bool query_init_templates(struct my_table *t)
+{
+	char *size, *cond, *column, *xattrs, *checksum;
+	unsigned int i, length;
+
+	//
+	// Trace template of the key condition: every key field compared to a
+	// value left out
+	//
+
+	length = 1;
+
+	for (i = 0; i <= t->levels; i++)
+	{
+		length += strlen(t->fields[i]) + 9;
+	}
+
+	cond = (char*) malloc(length);
+	if (cond == NULL)
+	{
+		return 0;
+	}
+
+	//
+	// Extended attribute fields are selected after the size
+	//
+
+	length = 1;
+
+	for (i = 0; i < my_xattr_count; i++)
+	{
+		length += strlen(my_xattr_fields[i]) + 2;
+	}
+
+	xattrs = (char*) malloc(length);
+	if (xattrs == NULL)
+	{
+		free(cond);
+		return 0;
+	}
+
+	xattrs[0] = '\0';
+
+	for (i = 0; i < my_xattr_count; i++)
+	{
+		sprintf(xattrs + strlen(xattrs), ", %s", my_xattr_fields[i]);
+	}
+
+	cond[0] = '\0';
+
+	for (i = 0; i <= t->levels; i++)
+	{
+		sprintf(cond + strlen(cond), "%s%s = ?", i > 0 ? " AND " : "", t->fields[i]);
+	}
+
+	length = strlen(prefetch_sp) + strlen(stripe_qp) + strlen(range_qp) + strlen(bounds_qp) +
+		strlen(level_qp) + strlen(files_qp) + 4 * strlen(t->data_field) +
+		2 * strlen(t->table) + 5 * strlen(t->name_field) + 3 * strlen(cond) +
+		2 * strlen(xattrs) + strlen(size_fp) + 32;
+
+	size = (char*) malloc(strlen(size_fp) + strlen(t->data_field) + strlen(xattrs) + 3);
+	checksum = (char*) malloc(strlen(t->data_field) + 32);
+	if (size == NULL || checksum == NULL)
+	{
+		free(size);
+		free(checksum);
+		free(cond);
+		free(xattrs);
+		return 0;
+	}
+
+	//
+	// The data column is only known per query, the trace names it if
+	// there is just one
+	//
+
+	column = t->column_count > 1 ? "?" : t->data_field;
+
+	for (i = 0; i < MY_QUERY_KINDS; i++)
+	{
+		t->formats[i] = (char*) malloc(length);
+		t->templates[i] = (char*) malloc(length);
+
+		if (t->formats[i] == NULL || t->templates[i] == NULL)
+		{
+			free(size);
+			free(checksum);
+			free(cond);
+			free(xattrs);
+			return 0;
+		}
+	}
+
+	//
+	// Identifiers are checked to contain letters, digits and underscores
+	// only, so they never introduce conversions of their own
+	//
+
+	sprintf(size, size_fp, "%s");
+	strcat(size, xattrs);
+	sprintf(t->formats[QUERY_ATTR], read_qp, size, t->table, "%s");
+	sprintf(t->formats[QUERY_EXISTS], read_qp, "1", t->table, "%s");
+	sprintf(t->formats[QUERY_LIST], readdir_qp, t->name_field, t->table, t->name_field);
+	sprintf(t->formats[QUERY_FETCH], read_qp, "%s", t->table, "%s");
+	sprintf(t->formats[QUERY_PIPELINE], prefetch_sp, "%s", "%s", "%u", "%s", xattrs,
+		t->table, "%s");
+	sprintf(t->formats[QUERY_STRIPE], stripe_qp, "%s", "%llu", "%lu", t->table, "%s");
+	sprintf(t->formats[QUERY_RANGE], range_qp, t->name_field, t->table, t->name_field,
+		"%llu", "%llu", t->name_field);
+	sprintf(t->formats[QUERY_BOUNDS], bounds_qp, t->name_field, t->name_field, t->table);
+	sprintf(t->formats[QUERY_LEVEL], level_qp, "%s", t->table, "%s", "%s");
+	sprintf(t->formats[QUERY_FILES], files_qp, t->name_field, t->table, "%s", t->name_field);
+	sprintf(checksum, my_checksum != NULL ? my_checksum->expr : "NULL", "%s");
+	sprintf(t->formats[QUERY_CHECKSUM], read_qp, checksum, t->table, "%s");
+
+	sprintf(size, size_fp, column);
+	strcat(size, xattrs);
+	sprintf(t->templates[QUERY_ATTR], read_qp, size, t->table, cond);
+	sprintf(t->templates[QUERY_EXISTS], read_qp, "1", t->table, cond);
+	sprintf(t->templates[QUERY_LIST], readdir_qp, t->name_field, t->table, t->name_field);
+	sprintf(t->templates[QUERY_FETCH], read_qp, column, t->table, cond);
+	sprintf(t->templates[QUERY_PIPELINE], prefetch_sp, column, column, "?", column,
+		xattrs, t->table, cond);
+	sprintf(t->templates[QUERY_STRIPE], stripe_qp, column, "?", "?", t->table, cond);
+	sprintf(t->templates[QUERY_RANGE], range_qp, t->name_field, t->table, t->name_field,
+		"?", "?", t->name_field);
+	sprintf(t->templates[QUERY_BOUNDS], bounds_qp, t->name_field, t->name_field, t->table);
+	sprintf(t->templates[QUERY_LEVEL], level_qp, "?", t->table, "?", "?");
+	sprintf(t->templates[QUERY_FILES], files_qp, t->name_field, t->table, "?", t->name_field);
+	sprintf(checksum, my_checksum != NULL ? my_checksum->expr : "NULL", column);
+	sprintf(t->templates[QUERY_CHECKSUM], read_qp, checksum, t->table, cond);
+
+	free(size);
+	free(checksum);
+	free(cond);
+	free(xattrs);
+
+	return 1;
+}
+
+/**
+ * Frees the buffers of an exiting thread
+ */
+static void buf_release(void *arg)
+{
+	free(query_buf.data);
+	free(names_buf.data);
+	free(key_buf.data);
+	free(xattrs_buf.data);
+
+	query_buf.data = names_buf.data = key_buf.data = xattrs_buf.data = NULL;
+	query_buf.size = names_buf.size = key_buf.size = xattrs_buf.size = 0;
+}
+
+/**
+ * Makes buf at least size bytes large. Returns if it succeeded
+ */
+static my_bool buf_reserve(struct my_buf *buf, size_t size)
+{
+	char *data;
+	size_t grown;
+
+	if (buf->size >= size)
+	{
+		return 1;
+	}
+
+	grown = buf->size > BUF_MIN ? 2 * buf->size : BUF_MIN;
+	if (grown < size)
+	{
+		grown = size;
+	}
+
+	data = (char*) realloc(buf->data, grown);
+	if (data == NULL)
+	{
+		return 0;
+	}
+
+	buf->data = data;
+	buf->size = grown;
+
+	pthread_setspecific(buf_key, buf);
+
+	return 1;
+}
+
+/**
+ * Packs the extended attribute fields of a result row, starting at column
+ * first, into a buffer of the current thread, valid until the next call,
+ * with its size in *size. Every value is stored as its length, ULONG_MAX for
+ * NULL, followed by its bytes. Returns NULL if there are no such fields, or
+ * if out of memory
+ */
+static char *xattrs_pack(MYSQL_ROW row, unsigned long *lengths, unsigned int first,
+	unsigned long *size)
+{
+	char *xattrs, *p;
+	unsigned long len;
+	unsigned int i;
+
+	if (my_xattr_count == 0)
+	{
+		return NULL;
+	}
+
+	*size = 0;
+
+	for (i = 0; i < my_xattr_count; i++)
+	{
+		*size += sizeof(unsigned long) + (row[first + i] != NULL ? lengths[first + i] : 0);
+	}
+
+	if (!buf_reserve(&xattrs_buf, *size))
+	{
+		return NULL;
+	}
+
+	xattrs = xattrs_buf.data;
+
+	for (p = xattrs, i = 0; i < my_xattr_count; i++)
+	{
+		len = row[first + i] != NULL ? lengths[first + i] : ULONG_MAX;
+		memcpy(p, &len, sizeof(unsigned long));
+		p += sizeof(unsigned long);
+
+		if (row[first + i] != NULL)
+		{
+			memcpy(p, row[first + i], len);
+			p += len;
+		}
+	}
+
+	return xattrs;
+}
+
+/**
+ * Appends statement of the query kind for table, formatted with the values
+ * that follow, to the query buffer of the current thread at *length, and advances
+ * *length past it. Returns the buffer, or NULL if out of memory
+ */
+static char *query_build(size_t *length, const struct my_table *table,
+	enum my_query_kind kind, ...)
+{
+	va_list ap;
+	int n;
+
+	n = 0;
+
+	while (buf_reserve(&query_buf, *length + n + 1))
+	{
+		va_start(ap, kind);
+		n = vsnprintf(query_buf.data + *length, query_buf.size - *length,
+			table->formats[kind], ap);
+		va_end(ap);
+
+		if (n < 0)
+		{
+			return NULL;
+		}
+
+		if (*length + n < query_buf.size)
+		{
+			*length += n;
+			return query_buf.data;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Returns condition selecting rows of table by name, to be used in queries.
+ * Name is the path of a row or directory within the table: its components
+ * are compared to the key fields in order, so a directory of a composite key
+ * selects every row below it, and "" selects the whole table. Values are
+ * unchanged for integer names, hexadecimal string literals for string ones.
+ * The latter need no escaping and no connection to learn the character set
+ * from. The condition is valid until the next call from the same thread.
+ * Returns NULL if out of memory
+ */
+static const char *key_condition(const struct my_table *table, const char *name)
+{
+	const char *c, *slash;
+	unsigned int i;
+	size_t len, size, at;
+
+	if (name[0] == '\0')
+	{
+		return "TRUE";
+	}
+
+	size = 2 * strlen(name) + 1;
+
+	for (i = 0; i <= table->levels; i++)
+	{
+		size += strlen(table->fields[i]) + 11;
+	}
+
+	if (!buf_reserve(&key_buf, size))
+	{
+		return NULL;
+	}
+
+	at = 0;
+
+	for (c = name, i = 0; i <= table->levels; c = slash + 1, i++)
+	{
+		slash = strchr(c, '/');
+		len = slash != NULL ? (size_t) (slash - c) : strlen(c);
+
+		at += sprintf(key_buf.data + at, "%s%s = ", i > 0 ? " AND " : "", table->fields[i]);
+
+		if (my_string_keys)
+		{
+			key_buf.data[at++] = 'X';
+			key_buf.data[at++] = '\'';
+			at += mysql_hex_string(key_buf.data + at, c, len);
+			key_buf.data[at++] = '\'';
+		}
+		else
+		{
+			memcpy(key_buf.data + at, c, len);
+			at += len;
+		}
+
+		if (slash == NULL)
+		{
+			break;
+		}
+	}
+
+	key_buf.data[at] = '\0';
+
+	return key_buf.data;
+}
+
+/**
+ * Returns condition selecting row name of table, which also has to hold the
+ * condition of view, unless it is NULL. Valid until the next call from the
+ * same thread. Returns NULL if out of memory
+ */
+static const char *row_condition(const struct my_table *table, const char *name,
+	const struct my_view *view)
+{
+	const char *cond;
+	size_t len;
+
+	cond = key_condition(table, name);
+
+	if (cond == NULL || view == NULL)
+	{
+		return cond;
+	}
+
+	len = strlen(cond);
+
+	if (!buf_reserve(&key_buf, len + strlen(view->condition) + 8))
+	{
+		return NULL;
+	}
+
+	sprintf(key_buf.data + len, " AND (%s)", view->condition);
+
+	return key_buf.data;
+}
+
+/**
+ * Returns condition selecting the row of file p, which also has to hold the
+ * condition of its view, if it is in one. Valid until the next call from the
+ * same thread. Returns NULL if out of memory
+ */
+static const char *path_condition(const struct my_path *p)
+{
+	return row_condition(p->table, p->name, p->view);
+}
+
+/**
+ * Queues a trace record for the query that just completed on the connection,
+ * if it is slow enough or picked by sampling. Never blocks: if the writer
+ * falls behind, the record is dropped and counted
+ */
+static void trace_query(struct my_conn *conn, unsigned long duration)
+{
+	struct trace_record *rec;
+	unsigned long seq;
+	unsigned int threshold, interval;
+	my_bool slow, sampled;
+
+	if (trace_file == NULL)
+	{
+		return;
+	}
+
+	//
+	// Both settings may be changed through the control file meanwhile, so
+	// each is read once; a sampling interval of 0 samples nothing
+	//
+
+	threshold = __atomic_load_n(&trace_slow, __ATOMIC_RELAXED);
+	slow = threshold > 0 && duration >= threshold * 1000UL;
+
+	interval = __atomic_load_n(&trace_sample, __ATOMIC_RELAXED);
+	seq = __sync_fetch_and_add(&trace_seq, 1);
+	sampled = interval > 0 && seq % interval == 0;
+
+	if (!slow && !sampled)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&trace_lock);
+
+	if (trace_tail - trace_head == TRACE_RING)
+	{
+		trace_dropped++;
+		pthread_mutex_unlock(&trace_lock);
+		return;
+	}
+
+	rec = &trace_ring[trace_tail % TRACE_RING];
+
+	clock_gettime(CLOCK_REALTIME, &rec->when);
+	rec->endpoint = conn->endpoint;
+	rec->conn_id = mysql_thread_id(&conn->mysql);
+	rec->table = conn->table;
+	rec->kind = conn->kind;
+	rec->duration = duration;
+	rec->rows = conn->rows;
+	rec->bytes = conn->received;
+	rec->status = conn->cancelled ? conn->cancelled :
+		(conn->query_failed || conn->failed) ? -EIO : 0;
+	strcpy(rec->key, conn->key);
+
+	trace_tail++;
+
+	pthread_cond_signal(&trace_cond);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/**
+ * Writes queued trace records to the trace file, one tab-separated line per
+ * query. Runs as a thread
+ */
+static void *trace_write(void *arg)
+{
+	struct trace_record rec;
+	unsigned long dropped;
+	struct tm tm;
+	char when[32];
+
+	for (;;)
+	{
+		pthread_mutex_lock(&trace_lock);
+
+		while (trace_head == trace_tail && trace_dropped == 0)
+		{
+			pthread_cond_wait(&trace_cond, &trace_lock);
+		}
+
+		dropped = trace_dropped;
+		trace_dropped = 0;
+
+		if (trace_head != trace_tail)
+		{
+			rec = trace_ring[trace_head % TRACE_RING];
+			trace_head++;
+		}
+		else
+		{
+			rec.endpoint = NULL;
+		}
+
+		pthread_mutex_unlock(&trace_lock);
+
+		if (dropped > 0)
+		{
+			fprintf(trace_file, "# dropped %lu records\n", dropped);
+		}
+
+		if (rec.endpoint != NULL)
+		{
+			localtime_r(&rec.when.tv_sec, &tm);
+			strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+
+			fprintf(trace_file, "%s.%06ld\t%s:%u\t%lu\t%s\t%lu\t%lu\t%lu\t%d\t%s\t%s\n",
+				when, rec.when.tv_nsec / 1000,
+				rec.endpoint->host != NULL ? rec.endpoint->host : "localhost",
+				rec.endpoint->port, rec.conn_id, query_names[rec.kind], rec.duration,
+				rec.rows, rec.bytes, rec.status, rec.key, rec.table->templates[rec.kind]);
+		}
+
+		//
+		// Flush once the queue is drained, so that a burst is written out in
+		// large chunks
+		//
+
+		pthread_mutex_lock(&trace_lock);
+		if (trace_head == trace_tail)
+		{
+			fflush(trace_file);
+		}
+		pthread_mutex_unlock(&trace_lock);
+	}
+
+	return NULL;
+}
+
+/**
+ * Queues a recording entry for an operation on path that started at start.
+ * Never blocks: if the writer falls behind, the entry is dropped and counted
+ */
+static void record_op(enum record_op op, const char *path, const struct timespec *start,
+	off_t offset, size_t size, int result)
+{
+	struct record_entry *entry;
+	struct timespec now;
+	struct my_path p;
+
+	if (record_file == NULL)
+	{
+		return;
+	}
+
+	if (!path_resolve(path, &p))
+	{
+		p.kind = PATH_DIR;
+		p.depth = 0;
+		p.lo = 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	pthread_mutex_lock(&record_lock);
+
+	if (record_tail - record_head == RECORD_RING)
+	{
+		record_dropped++;
+		pthread_mutex_unlock(&record_lock);
+		return;
+	}
+
+	entry = &record_ring[record_tail % RECORD_RING];
+	memset(entry, 0, sizeof(struct record_entry));
+
+	entry->start = (start->tv_sec - record_started.tv_sec) * 1000000ULL +
+		start->tv_nsec / 1000 - record_started.tv_nsec / 1000;
+	entry->duration = (now.tv_sec - start->tv_sec) * 1000000UL +
+		now.tv_nsec / 1000 - start->tv_nsec / 1000;
+	entry->pid = fuse_get_context()->pid;
+	entry->key = p.kind == PATH_FILE ? strtoull(p.key, NULL, 10) : p.lo;
+	entry->offset = offset;
+	entry->size = size;
+	entry->result = result;
+	entry->op = op;
+	entry->depth = p.kind == PATH_DIR ? p.depth + 1 : 0;
+
+	record_tail++;
+
+	pthread_cond_signal(&record_cond);
+	pthread_mutex_unlock(&record_lock);
+}
+
+/**
+ * Returns the index of extended attribute name recorded for getxattr: that
+ * of its field, that past the fields for a computed checksum, or
+ * RECORD_XATTR_UNKNOWN
+ */
+static uint64_t record_xattr_index(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < my_xattr_count; i++)
+	{
+		if (strcmp(name, my_xattr_names[i]) == 0)
+		{
+			return i;
+		}
+	}
+
+	if (my_checksum != NULL && strcmp(name, my_checksum_xattr) == 0)
+	{
+		return my_xattr_count;
+	}
+
+	return RECORD_XATTR_UNKNOWN;
+}
+
+/**
+ * Writes queued recording entries to the file. Runs as a thread
+ */
+static void *record_write(void *arg)
+{
+	struct record_entry entry, lost;
+	unsigned long dropped;
+	my_bool queued;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&record_lock);
+
+		while (record_head == record_tail && record_dropped == 0)
+		{
+			pthread_cond_wait(&record_cond, &record_lock);
+		}
+
+		dropped = record_dropped;
+		record_dropped = 0;
+
+		queued = record_head != record_tail;
+		if (queued)
+		{
+			entry = record_ring[record_head % RECORD_RING];
+			record_head++;
+		}
+
+		pthread_mutex_unlock(&record_lock);
+
+		if (dropped > 0)
+		{
+			memset(&lost, 0, sizeof(struct record_entry));
+			lost.op = RECORD_DROPPED;
+			lost.size = dropped;
+			fwrite(&lost, sizeof(struct record_entry), 1, record_file);
+		}
+
+		if (queued)
+		{
+			fwrite(&entry, sizeof(struct record_entry), 1, record_file);
+		}
+
+		//
+		// Flush once the queue is drained, as the trace writer does
+		//
+
+		pthread_mutex_lock(&record_lock);
+		if (record_head == record_tail)
+		{
+			fflush(record_file);
+		}
+		pthread_mutex_unlock(&record_lock);
+	}
+
+	return NULL;
+}
+
+/**
+ * Returns connection to the pool, updating latency and health statistics of
+ * its endpoint. Connections that failed are closed
+ */
+static void pool_release(struct my_conn *conn)
+{
+	struct my_endpoint *ep;
+	struct stats_shard *shard;
+	unsigned long duration;
+	struct timespec now;
+	double elapsed;
+	my_bool retire;
+
+	if (conn == NULL)
+	{
+		return;
+	}
+
+	ep = conn->endpoint;
+
+	//
+	// Account for the query that ran on the connection
+	//
+
+	if (conn->querying)
+	{
+		duration = stats_elapsed(&conn->query_start);
+		trace_query(conn, duration);
+
+		MY_PROBE(query_done, query_names[conn->kind], conn->key, conn->rows,
+			conn->received, duration, conn->cancelled ? conn->cancelled :
+			(conn->query_failed || conn->failed) ? -EIO : 0);
+
+		shard = stats_shard();
+		if (shard != NULL)
+		{
+			hist_record(&shard->queries[conn->kind], duration);
+			shard->query_bytes[conn->kind] += conn->received;
+
+			if (conn->query_failed || conn->failed || conn->cancelled)
+			{
+				shard->query_errors[conn->kind]++;
+			}
+		}
+
+		conn->querying = 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - conn->acquired.tv_sec) * 1e6 +
+		(now.tv_nsec - conn->acquired.tv_nsec) / 1e3;
+
+	//
+	// Take the connection out of the watchdog's sight
+	//
+
+	pthread_mutex_lock(&pool_lock);
+
+	if (conn->busy_prev != NULL)
+	{
+		conn->busy_prev->busy_next = conn->busy_next;
+	}
+	else
+	{
+		pool_busy = conn->busy_next;
+	}
+
+	if (conn->busy_next != NULL)
+	{
+		conn->busy_next->busy_prev = conn->busy_prev;
+	}
+
+	conn->request->conns--;
+
+	pthread_mutex_unlock(&pool_lock);
+
+	//
+	// Wait for a KILL QUERY that may still be on its way. If the query
+	// finished before it arrived, the kill may hit the next statement, so
+	// absorb it with a no-op one before reusing the connection
+	//
+
+	pthread_mutex_lock(&conn->kill_lock);
+	pthread_mutex_unlock(&conn->kill_lock);
+
+	if (conn->cancelled && !conn->failed)
+	{
+		if (mysql_query(&conn->mysql, "DO 0") != 0 && mysql_errno(&conn->mysql) >= 2000)
+		{
+			conn->failed = 1;
+		}
+	}
+
+	pthread_mutex_lock(&pool_lock);
+
+	ep->inflight--;
+	ep->busy[conn->class]--;
+	ep->queries++;
+
+	if (conn->failed)
+	{
+		pool_fail(ep);
+	}
+	else if (!conn->cancelled)
+	{
+		ep->latency = ep->latency ? 0.8 * ep->latency + 0.2 * elapsed : elapsed;
+		ep->failures = 0;
+		ep->backoff = 0;
+	}
+
+	//
+	// Connections beyond the pool size, which may have been lowered through
+	// the control file, are closed rather than kept idle
+	//
+
+	retire = conn->failed || ep->open > pool_size;
+
+	if (retire)
+	{
+		ep->open--;
+	}
+	else
+	{
+		conn->next = ep->idle;
+		ep->idle = conn;
+	}
+
+	//
+	// Waiters of different classes may be eligible for the connection, let
+	// them sort out whose turn it is
+	//
+
+	pthread_cond_broadcast(&pool_cond);
+	pthread_mutex_unlock(&pool_lock);
+
+	if (retire)
+	{
+		mysql_close(&conn->mysql);
+		pthread_mutex_destroy(&conn->kill_lock);
+		free(conn);
+	}
+}
+
+/**
+ * Marks start of a query of the kind on table for key (NULL if there is none)
+ * on the connection, for statistics and tracing
+ */
+static void my_query_begin(struct my_conn *conn, const struct my_table *table,
+	enum my_query_kind kind, const char *key)
+{
+	conn->table = table;
+	conn->kind = kind;
+	conn->querying = 1;
+	conn->query_failed = 0;
+	conn->received = 0;
+	conn->rows = 0;
+
+	conn->key[0] = '\0';
+	if (key != NULL)
+	{
+		strncat(conn->key, key, TRACE_KEY_MAX - 1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &conn->query_start);
+
+	MY_PROBE(query_start, query_names[kind], conn->key, conn->endpoint->host,
+		conn->endpoint->port, mysql_thread_id(&conn->mysql));
+}
+
+/**
+ * Returns negated error code for a query that has been cancelled on the
+ * connection (-EINTR if the request was interrupted, -ETIMEDOUT if it ran out
+ * of time), or fallback otherwise
+ */
+static int my_status(struct my_conn *conn, int fallback)
+{
+	if (conn != NULL && conn->cancelled)
+	{
+		return conn->cancelled;
+	}
+
+	return fallback;
+}
+
+/**
+ * Handles the signal FUSE sends to a worker thread whose request has been
+ * interrupted
+ */
+static void my_interrupt(int signum)
+{
+	if (my_current != NULL && my_current->conns > 0)
+	{
+		my_current->interrupted = 1;
+	}
+}
+
+/**
+ * Issues KILL QUERY for the connection over a side connection to the same
+ * server. Called by the watchdog with conn->kill_lock held
+ */
+static void watchdog_kill(struct my_conn *conn, unsigned long id)
+{
+	struct my_endpoint *ep = conn->endpoint;
+	char query[32];
+
+	if (ep->killer == NULL)
+	{
+		ep->killer = mysql_init(NULL);
+		if (ep->killer == NULL)
+		{
+			return;
+		}
+
+		if (mysql_real_connect(ep->killer, ep->host, my_username, my_password,
+			my_database, ep->port, NULL, 0) == NULL)
+		{
+			mysql_close(ep->killer);
+			ep->killer = NULL;
+			return;
+		}
+	}
+
+	sprintf(query, "KILL QUERY %lu", id);
+
+	if (mysql_query(ep->killer, query) != 0 && mysql_errno(ep->killer) >= 2000)
+	{
+		mysql_close(ep->killer);
+		ep->killer = NULL;
+	}
+}
+
+/**
+ * Periodically cancels queries that ran out of time or whose requests have
+ * been interrupted. Runs as a thread
+ */
+static void *watchdog_run(void *arg)
+{
+	struct my_conn *conn, *victim;
+	struct timespec now, period;
+	unsigned long id;
+
+	period.tv_sec = 0;
+	period.tv_nsec = WATCHDOG_PERIOD * 1000000L;
+
+	for (;;)
+	{
+		nanosleep(&period, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		//
+		// Kill one query at a time, so that pool_lock is not held while
+		// talking to the server
+		//
+
+		do
+		{
+			victim = NULL;
+
+			pthread_mutex_lock(&pool_lock);
+
+			for (conn = pool_busy; conn != NULL; conn = conn->busy_next)
+			{
+				if (conn->cancelled)
+				{
+					continue;
+				}
+
+				if (conn->request->interrupted)
+				{
+					conn->cancelled = -EINTR;
+				}
+				else if (conn->has_deadline && (now.tv_sec > conn->deadline.tv_sec ||
+					(now.tv_sec == conn->deadline.tv_sec && now.tv_nsec >= conn->deadline.tv_nsec)))
+				{
+					conn->cancelled = -ETIMEDOUT;
+				}
+				else
+				{
+					continue;
+				}
+
+				victim = conn;
+				pthread_mutex_lock(&victim->kill_lock);
+				break;
+			}
+
+			pthread_mutex_unlock(&pool_lock);
+
+			if (victim != NULL)
+			{
+				id = mysql_thread_id(&victim->mysql);
+				watchdog_kill(victim, id);
+				pthread_mutex_unlock(&victim->kill_lock);
+			}
+		}
+		while (victim != NULL);
+	}
+
+	return NULL;
+}
+
+/**
+ * Metrics text being formatted: the buffer, its size and the length of the
+ * text so far
+ */
+struct metrics_text
+{
+	char *data;
+	size_t size, length;
+};
+
+/**
+ * Size metrics text buffers start with
+ */
+#define METRICS_TEXT_MIN 65536
+
+/**
+ * Appends formatted text to the metrics text, growing its buffer as needed.
+ * If out of memory, frees the buffer, leaving data NULL, and further calls
+ * do nothing
+ */
+static void metrics_printf(struct metrics_text *text, const char *format, ...)
+{
+	va_list ap;
+	char *data;
+	size_t grown;
+	int n;
+
+	while (text->data != NULL)
+	{
+		va_start(ap, format);
+		n = vsnprintf(text->data + text->length, text->size - text->length, format, ap);
+		va_end(ap);
+
+		if (n < 0)
+		{
+			break;
+		}
+
+		if (text->length + n < text->size)
+		{
+			text->length += n;
+			return;
+		}
+
+		grown = 2 * text->size;
+		if (grown < text->length + n + 1)
+		{
+			grown = text->length + n + 1;
+		}
+
+		data = (char*) realloc(text->data, grown);
+		if (data == NULL)
+		{
+			break;
+		}
+
+		text->data = data;
+		text->size = grown;
+	}
+
+	free(text->data);
+	text->data = NULL;
+}
+
+/**
+ * Appends Prometheus summary of histogram, labelled with label="value", to
+ * the metrics text
+ */
+static void metrics_format_hist(struct metrics_text *text, const char *metric,
+	const char *label, const char *value, const struct stats_hist *hist)
+{
+	static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	unsigned int i;
+
+	for (i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++)
+	{
+		metrics_printf(text, "%s{%s=\"%s\",quantile=\"%g\"} %g\n", metric, label, value,
+			quantiles[i], hist_quantile(hist, quantiles[i]) / 1e6);
+	}
+
+	metrics_printf(text, "%s_sum{%s=\"%s\"} %g\n", metric, label, value, hist->sum / 1e6);
+	metrics_printf(text, "%s_count{%s=\"%s\"} %lu\n", metric, label, value, hist->total);
+}
+
+/**
+ * Returns current metrics in Prometheus text exposition format as newly
+ * allocated text, or NULL if out of memory
+ */
+static char *metrics_format(void)
+{
+	struct stats_shard *total;
+	struct my_endpoint *ep;
+	unsigned long fetched, used, idle;
+	unsigned int i, inflight;
+	char *host;
+	struct metrics_text text;
+	struct my_conn *conn;
+
+	total = (struct stats_shard*) malloc(sizeof(struct stats_shard));
+	text.size = METRICS_TEXT_MIN;
+	text.length = 0;
+	text.data = (char*) malloc(text.size);
+
+	if (total == NULL || text.data == NULL)
+	{
+		free(total);
+		free(text.data);
+		return NULL;
+	}
+
+	stats_collect(total);
+
+	//
+	// File system operations and server queries
+	//
+
+	metrics_printf(&text, "# TYPE myblobfs_op_latency_seconds summary\n");
+	for (i = 0; i < MY_OPS; i++)
+	{
+		metrics_format_hist(&text, "myblobfs_op_latency_seconds", "op", op_names[i], &total->ops[i]);
+	}
+
+	metrics_printf(&text, "# TYPE myblobfs_op_errors_total counter\n");
+	for (i = 0; i < MY_OPS; i++)
+	{
+		metrics_printf(&text, "myblobfs_op_errors_total{op=\"%s\"} %lu\n", op_names[i], total->op_errors[i]);
+	}
+
+	fetched = 0;
+
+	metrics_printf(&text, "# TYPE myblobfs_query_latency_seconds summary\n");
+	for (i = 0; i < MY_QUERY_KINDS; i++)
+	{
+		metrics_format_hist(&text, "myblobfs_query_latency_seconds", "kind", query_names[i],
+			&total->queries[i]);
+		fetched += total->query_bytes[i];
+	}
+
+	metrics_printf(&text, "# TYPE myblobfs_query_errors_total counter\n");
+	for (i = 0; i < MY_QUERY_KINDS; i++)
+	{
+		metrics_printf(&text, "myblobfs_query_errors_total{kind=\"%s\"} %lu\n", query_names[i],
+			total->query_errors[i]);
+	}
+
+	metrics_printf(&text, "# TYPE myblobfs_bytes_fetched_total counter\n");
+	metrics_printf(&text, "myblobfs_bytes_fetched_total %lu\n", fetched);
+	metrics_printf(&text, "# TYPE myblobfs_bytes_served_total counter\n");
+	metrics_printf(&text, "myblobfs_bytes_served_total %lu\n", total->bytes_served);
+
+	//
+	// Row cache
+	//
+
+	pthread_mutex_lock(&cache_lock);
+	used = cache_used;
+	pthread_mutex_unlock(&cache_lock);
+
+	metrics_printf(&text, "# TYPE myblobfs_cache_hits_total counter\n");
+	metrics_printf(&text, "myblobfs_cache_hits_total %lu\n", total->cache_hits);
+	metrics_printf(&text, "# TYPE myblobfs_cache_misses_total counter\n");
+	metrics_printf(&text, "myblobfs_cache_misses_total %lu\n", total->cache_misses);
+	metrics_printf(&text, "# TYPE myblobfs_cache_bytes gauge\n");
+	metrics_printf(&text, "myblobfs_cache_bytes %lu\n", used);
+	metrics_printf(&text, "# TYPE myblobfs_cache_budget_bytes gauge\n");
+	metrics_printf(&text, "myblobfs_cache_budget_bytes %lu\n", cache_budget);
+
+	//
+	// Connection pool
+	//
+
+	pthread_mutex_lock(&pool_lock);
+
+	inflight = 0;
+
+	metrics_printf(&text, "# TYPE myblobfs_pool_size gauge\n");
+	metrics_printf(&text, "myblobfs_pool_size %u\n", pool_size);
+	metrics_printf(&text, "# TYPE myblobfs_pool_connections gauge\n");
+	metrics_printf(&text, "# TYPE myblobfs_endpoint_latency_seconds gauge\n");
+	metrics_printf(&text, "# TYPE myblobfs_endpoint_queries_total counter\n");
+	metrics_printf(&text, "# TYPE myblobfs_endpoint_errors_total counter\n");
+	metrics_printf(&text, "# TYPE myblobfs_endpoint_ejected gauge\n");
+
+	for (i = 0; i < pool_count; i++)
+	{
+		ep = &pool_endpoints[i];
+		host = ep->host != NULL ? ep->host : "localhost";
+
+		for (idle = 0, conn = ep->idle; conn != NULL; conn = conn->next)
+		{
+			idle++;
+		}
+
+		metrics_printf(&text, "myblobfs_pool_connections{endpoint=\"%s:%u\",state=\"busy\"} %u\n",
+			host, ep->port, ep->inflight);
+		metrics_printf(&text, "myblobfs_pool_connections{endpoint=\"%s:%u\",state=\"idle\"} %lu\n",
+			host, ep->port, idle);
+		metrics_printf(&text, "myblobfs_endpoint_latency_seconds{endpoint=\"%s:%u\"} %g\n",
+			host, ep->port, ep->latency / 1e6);
+		metrics_printf(&text, "myblobfs_endpoint_queries_total{endpoint=\"%s:%u\"} %lu\n",
+			host, ep->port, ep->queries);
+		metrics_printf(&text, "myblobfs_endpoint_errors_total{endpoint=\"%s:%u\"} %lu\n",
+			host, ep->port, ep->errors);
+		metrics_printf(&text, "myblobfs_endpoint_ejected{endpoint=\"%s:%u\"} %d\n",
+			host, ep->port, ep->ejected_until > time(NULL));
+
+		inflight += ep->inflight;
+	}
+
+	metrics_printf(&text, "# TYPE myblobfs_queries_in_flight gauge\n");
+	metrics_printf(&text, "myblobfs_queries_in_flight %u\n", inflight);
+
+	pthread_mutex_unlock(&pool_lock);
+
+	free(total);
+
+	return text.data;
+}
+
+/**
+ * Writes all of len bytes of buf to fd. Returns if it succeeded
+ */
+static my_bool write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0)
+	{
+		n = write(fd, buf, len);
+
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (n <= 0)
+		{
+			return 0;
+		}
+
+		buf += n;
+		len -= n;
+	}
+
+	return 1;
+}
+
+/**
+ * Serves metrics over the Unix socket: every connection gets a plain HTTP
+ * response with current metrics, whatever it asks for. Runs as a thread
+ */
+static void *metrics_serve(void *arg)
+{
+	int sock = (int) (intptr_t) arg, client;
+	char header[128], request[1024];
+	struct timeval timeout;
+	char *text;
+
+	timeout.tv_sec = 1;
+	timeout.tv_usec = 0;
+
+	for (;;)
+	{
+		client = accept(sock, NULL, NULL);
+		if (client < 0)
+		{
+			continue;
+		}
+
+		//
+		// Consume the request, if any, so that the client does not get a
+		// reset connection
+		//
+
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		(void) read(client, request, sizeof(request));
+
+		text = metrics_format();
+		if (text != NULL)
+		{
+			sprintf(header, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+				"Content-Length: %lu\r\n\r\n", (unsigned long) strlen(text));
+
+			if (write_all(client, header, strlen(header)))
+			{
+				write_all(client, text, strlen(text));
+			}
+
+			free(text);
+		}
+
+		close(client);
+	}
+
+	return NULL;
+}
+
+/**
+ * Rewrites the metrics file every metrics_interval seconds, replacing it
+ * atomically so that readers such as the node exporter textfile collector
+ * never see it half-written. Runs as a thread
+ */
+static void *metrics_dump(void *arg)
+{
+	char *tmp, *text;
+	int fd;
+
+	tmp = (char*) malloc(strlen(my_metrics_file) + 5);
+	if (tmp == NULL)
+	{
+		return NULL;
+	}
+
+	sprintf(tmp, "%s.tmp", my_metrics_file);
+
+	for (;;)
+	{
+		text = metrics_format();
+
+		if (text != NULL)
+		{
+			fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+			if (fd >= 0)
+			{
+				if (write_all(fd, text, strlen(text)) && close(fd) == 0)
+				{
+					rename(tmp, my_metrics_file);
+				}
+				else
+				{
+					unlink(tmp);
+				}
+			}
+
+			free(text);
+		}
+
+		sleep(my_metrics_interval);
+	}
+
+	return NULL;
+}
+
+/**
+ * Creates the Unix socket metrics are served on. Returns its descriptor or
+ * -1 on failure
+ */
+static int metrics_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	int sock;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		return -1;
+	}
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0)
+	{
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	unlink(path);
+
+	if (bind(sock, (struct sockaddr*) &addr, sizeof(struct sockaddr_un)) != 0 ||
+		listen(sock, 16) != 0)
+	{
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+/**
+ * Marks the query running on the connection as failed, and the connection
+ * too on client-side errors (lost connection and alike)
+ */
+static void my_query_fail(struct my_conn *conn)
+{
+	conn->query_failed = 1;
+
+	if (mysql_errno(&conn->mysql) >= 2000)
+	{
+		conn->failed = 1;
+	}
+}
+
+/**
+ * Sends query on the connection without waiting for the server to answer.
+ * Returns if it was sent; its result is then read with my_query_result()
+ */
+static my_bool my_query_send(struct my_conn *conn, const struct my_table *table,
+	enum my_query_kind kind, const char *key, const char *query)
+{
+	if (conn == NULL)
+	{
+		return 0;
+	}
+
+	my_query_begin(conn, table, kind, key);
+
+	if (mysql_send_query(&conn->mysql, query, (unsigned long) strlen(query)) != 0)
+	{
+		my_query_fail(conn);
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Waits for the answer to the query sent on the connection and returns its
+ * unbuffered result, or NULL on error
+ */
+static MYSQL_RES *my_query_result(struct my_conn *conn)
+{
+	MYSQL_RES *res;
+
+	res = mysql_read_query_result(&conn->mysql) == 0 ? mysql_use_result(&conn->mysql) : NULL;
+
+	if (res == NULL)
+	{
+		my_query_fail(conn);
+	}
+
+	return res;
+}
+
+/**
+ * Runs query on the connection and returns its unbuffered result, or NULL on
+ * error
+ */
+static MYSQL_RES *my_query(struct my_conn *conn, const struct my_table *table,
+	enum my_query_kind kind, const char *key, const char *query)
+{
+	return my_query_send(conn, table, kind, key, query) ? my_query_result(conn) : NULL;
+}
+
+/**
+ * Sends one multi-statement query fetching count rows of table, given by
+ * their cache keys, to server and stores every result set in the cache,
+ * consuming them in order. Returns 0 on success or negated error code
+ */
+static int my_fetch_batch(const struct my_table *table, char **names, unsigned int count,
+	enum my_class class, unsigned int server)
+{
+	char *query, *xattrs;
+	const char *name, *column, *cond;
+	unsigned int i;
+	size_t length;
+	unsigned long *lengths, xattrs_size;
+	int result, status;
+	struct my_conn *conn;
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+
+	//
+	// Build all statements into a single query text
+	//
+
+	length = 0;
+	query = NULL;
+
+	for (i = 0; i < count; i++)
+	{
+		name = key_split(table, names[i], &column);
+		cond = key_condition(table, name);
+		query = cond != NULL ? query_build(&length, table, QUERY_PIPELINE,
+			column, column, my_prefetch_max_size, column, cond) : NULL;
+		if (query == NULL)
+		{
+			return -ENOMEM;
+		}
+	}
+
+	//
+	// Send it in one round trip and consume result sets in statement order
+	//
+
+	result = 0;
+
+	conn = pool_acquire(class, server);
+
+	if (conn != NULL)
+	{
+		my_query_begin(conn, table, QUERY_PIPELINE, names[0]);
+	}
+
+	if (conn != NULL && mysql_real_query(&conn->mysql, query, (unsigned int) length) == 0)
+	{
+		i = 0;
+
+		do
+		{
+			res = mysql_use_result(&conn->mysql);
+
+			if (res != NULL)
+			{
+				row = mysql_fetch_row(res);
+
+				if (row != NULL && row[0] != NULL && i < count)
+				{
+					lengths = mysql_fetch_lengths(res);
+					xattrs = xattrs_pack(row, lengths, 2, &xattrs_size);
+					conn->received += lengths[1];
+					conn->rows++;
+					cache_store(names[i], strtoul(row[0], NULL, 10), row[1],
+						xattrs, xattrs_size);
+				}
+
+				while (mysql_fetch_row(res) != NULL);
+				mysql_free_result(res);
+			}
+
+			i++;
+			status = mysql_next_result(&conn->mysql);
+		}
+		while (status == 0);
+
+		if (status > 0)
+		{
+			result = my_status(conn, -EIO);
+		}
+	}
+	else
+	{
+		result = my_status(conn, -EIO);
+	}
+
+	if (conn != NULL && result != 0)
+	{
+		conn->query_failed = 1;
+
+		if (mysql_errno(&conn->mysql) >= 2000)
+		{
+			conn->failed = 1;
+		}
+	}
+
+	pool_release(conn);
+
+	return result;
+}
+
+/**
+ * Fetches count rows of table, given by their cache keys, into the cache
+ * with one pipelined query per server holding any of them, starting with
+ * the server of the first row. Rows the cache already holds are left out,
+ * compacting names. Returns 0 on success or negated error code
+ */
+static int my_fetch_pipelined(const struct my_table *table, char **names, unsigned int count,
+	enum my_class class)
+{
+	char **batch;
+	const char *column;
+	unsigned int first, server, i, k, n;
+	int result;
+
+	//
+	// Rows the cache already holds are left out
+	//
+
+	for (i = n = 0; i < count; i++)
+	{
+		if (!cache_covers(names[i]))
+		{
+			names[n++] = names[i];
+		}
+	}
+
+	count = n;
+
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	if (my_server_count <= 1)
+	{
+		return my_fetch_batch(table, names, count, class, 0);
+	}
+
+	batch = (char**) malloc(count * sizeof(char*));
+	if (batch == NULL)
+	{
+		return -ENOMEM;
+	}
+
+	result = 0;
+	first = key_server(key_split(table, names[0], &column));
+
+	for (k = 0; k < my_server_count && result == 0; k++)
+	{
+		server = (first + k) % my_server_count;
+		n = 0;
+
+		for (i = 0; i < count; i++)
+		{
+			if (key_server(key_split(table, names[i], &column)) == server)
+			{
+				batch[n++] = names[i];
+			}
+		}
+
+		result = n > 0 ? my_fetch_batch(table, batch, n, class, server) : 0;
+	}
+
+	free(batch);
+
+	return result;
+}
+
+/**
+ * Fills names_buf with cache key of a row of table, followed by cache keys
+ * of up to count - 1 rows that follow it in the name index, as an array of
+ * pointers. Returns number of keys, or 0 if out of memory
+ */
+static unsigned int name_neighbours(const struct my_table *table, const char *key,
+	unsigned int count)
+{
+	struct name_cursor cursor;
+	char **names, *buf;
+	const char *row, *column;
+	unsigned int i;
+
+	if (!buf_reserve(&names_buf, count * (sizeof(char*) + KEY_MAX)))
+	{
+		return 0;
+	}
+
+	names = (char**) names_buf.data;
+
+	buf = (char*) (names + count);
+	names[0] = (char*) key;
+	i = 1;
+
+	pthread_mutex_lock(&name_lock);
+
+	row = key_split(table, key, &column);
+
+	if (name_index != NULL && name_index->table == table &&
+		name_seek(&cursor, name_index, row))
+	{
+		for (; i < count && name_next(&cursor); i++)
+		{
+			names[i] = buf + i * KEY_MAX;
+			sprintf(names[i], "%.*s%s", (int) (row - key), key, cursor.name);
+		}
+	}
+
+	pthread_mutex_unlock(&name_lock);
+
+	return i;
+}
+
+/**
+ * Prefetches the row of table with cache key name and the rows that followed
+ * it in the latest directory listing, using a single pipelined round trip.
+ * Returns 0 if the row has been fetched, or negated error code
+ */
+static int my_prefetch_from(const struct my_table *table, const char *name)
+{
+	char **names, *buf;
+	const char *row, *column;
+	unsigned long long id;
+	unsigned int lo, hi, mid, last, i, count, window;
+	int result;
+
+	//
+	// The window may be changed through the control file meanwhile
+	//
+
+	window = __atomic_load_n(&my_prefetch, __ATOMIC_RELAXED);
+	if (window == 0)
+	{
+		window = 1;
+	}
+
+	//
+	// String names are looked up in the name index, which is sorted as well
+	//
+
+	if (my_string_keys)
+	{
+		count = name_neighbours(table, name, window);
+
+		return count > 0 ? my_fetch_pipelined(table, (char**) names_buf.data, count,
+			count > 1 ? MY_CLASS_PREFETCH : MY_CLASS_META) : -ENOMEM;
+	}
+
+	//
+	// Find name in the listing (which is sorted by the name field)
+	//
+
+	row = key_split(table, name, &column);
+	id = strtoull(row, NULL, 10);
+
+	pthread_mutex_lock(&hint_lock);
+
+	//
+	// Hints of another table's listing do not apply
+	//
+
+	last = hint_table == table ? hint_count : 0;
+
+	lo = 0;
+	hi = last;
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+
+		if (hint_names[mid] < id)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	count = 1;
+	if (lo < last && hint_names[lo] == id)
+	{
+		count = hint_count - lo;
+		if (count > window)
+		{
+			count = window;
+		}
+	}
+
+	if (!buf_reserve(&names_buf, count * (sizeof(char*) + KEY_MAX)))
+	{
+		pthread_mutex_unlock(&hint_lock);
+		return -ENOMEM;
+	}
+
+	names = (char**) names_buf.data;
+
+	buf = (char*) (names + count);
+	names[0] = (char*) name;
+
+	//
+	// Neighbours are fetched for the same data field, their keys differ
+	// in the row name only
+	//
+
+	for (i = 1; i < count; i++)
+	{
+		names[i] = buf + i * KEY_MAX;
+		sprintf(names[i], "%.*s%llu", (int) (row - name), name, hint_names[lo + i]);
+	}
+
+	pthread_mutex_unlock(&hint_lock);
+
+	//
+	// Only the requested row is needed right away; if others come along,
+	// the fetch is scheduled as background prefetch
+	//
+
+	result = my_fetch_pipelined(table, names, count,
+		count > 1 ? MY_CLASS_PREFETCH : MY_CLASS_META);
+
+	return result;
+}
+
+/**
+ * Formats the cache key under which stripe index of row name is stored
+ */
+static void stripe_key(char *key, const char *name, unsigned long long index)
+{
+	snprintf(key, STRIPE_KEY_MAX, "%s/%llu", name, index);
+}
+
+/**
+ * Fetches one stripe over its own pooled connection
+ */
+static void my_fetch_stripe(struct my_stripe *stripe)
+{
+	struct my_conn *conn;
+	char *query;
+	const char *name, *column, *cond;
+	size_t length;
+	unsigned long *lengths;
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+
+	stripe->result = -EIO;
+
+	length = 0;
+	name = key_split(stripe->table, stripe->name, &column);
+	cond = row_condition(stripe->table, name, stripe->view);
+	query = cond != NULL ? query_build(&length, stripe->table, QUERY_STRIPE, column,
+		stripe->index * my_stripe_size + 1, stripe->length, cond) : NULL;
+
+	if (query == NULL)
+	{
+		stripe->result = -ENOMEM;
+		return;
+	}
+
+	conn = pool_acquire(MY_CLASS_READ, key_server(name));
+	res = my_query(conn, stripe->table, QUERY_STRIPE, stripe->name, query);
+
+	if (res != NULL)
+	{
+		row = mysql_fetch_row(res);
+
+		if (row != NULL && row[0] != NULL)
+		{
+			lengths = mysql_fetch_lengths(res);
+
+			stripe->data = (char*) malloc(lengths[0] + 1);
+			if (stripe->data != NULL)
+			{
+				memcpy(stripe->data, row[0], lengths[0]);
+				stripe->received = lengths[0];
+				conn->received = lengths[0];
+				conn->rows = 1;
+				stripe->result = 0;
+			}
+			else
+			{
+				stripe->result = -ENOMEM;
+			}
+		}
+		else
+		{
+			stripe->result = my_status(conn, -ENOENT);
+		}
+
+		mysql_free_result(res);
+	}
+	else
+	{
+		stripe->result = my_status(conn, -EIO);
+	}
+
+	pool_release(conn);
+}
+
+/**
+ * Fetches stripes handed out by reading threads, on behalf of their
+ * requests. Runs as a thread until stripe_stop()
+ */
+static void *stripe_work(void *arg)
+{
+	struct my_stripe *stripe;
+
+	mysql_thread_init();
+
+	pthread_mutex_lock(&stripe_lock);
+
+	while (!stripe_stopping)
+	{
+		if (stripe_queue == NULL)
+		{
+			pthread_cond_wait(&stripe_queued, &stripe_lock);
+			continue;
+		}
+
+		stripe = stripe_queue;
+		stripe_queue = stripe->next;
+		if (stripe_queue == NULL)
+		{
+			stripe_tail = &stripe_queue;
+		}
+
+		pthread_mutex_unlock(&stripe_lock);
+
+		my_current = stripe->request;
+		my_fetch_stripe(stripe);
+		my_current = NULL;
+
+		pthread_mutex_lock(&stripe_lock);
+
+		stripe->done = 1;
+		pthread_cond_broadcast(&stripe_fetched);
+	}
+
+	pthread_mutex_unlock(&stripe_lock);
+
+	mysql_thread_end();
+
+	return NULL;
+}
+
+/**
+ * Starts count stripe workers
+ */
+static void stripe_start(unsigned int count)
+{
+	stripe_workers = (pthread_t*) calloc(count, sizeof(pthread_t));
+	if (stripe_workers == NULL)
+	{
+		return;
+	}
+
+	for (stripe_worker_count = 0; stripe_worker_count < count; stripe_worker_count++)
+	{
+		if (pthread_create(&stripe_workers[stripe_worker_count], NULL, stripe_work, NULL) != 0)
+		{
+			break;
+		}
+	}
+}
+
+/**
+ * Has the stripe workers exit and waits for them
+ */
+static void stripe_stop(void)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&stripe_lock);
+	stripe_stopping = 1;
+	pthread_cond_broadcast(&stripe_queued);
+	pthread_mutex_unlock(&stripe_lock);
+
+	for (i = 0; i < stripe_worker_count; i++)
+	{
+		pthread_join(stripe_workers[i], NULL);
+	}
+
+	free(stripe_workers);
+	stripe_workers = NULL;
+	stripe_worker_count = 0;
+}
+
+/**
+ * Hands count stripes out to the stripe workers, on behalf of the request of
+ * the current thread
+ */
+static void stripe_submit(struct my_stripe *stripes, unsigned int count)
+{
+	unsigned int i;
+
+	if (my_current == NULL)
+	{
+		my_current = &my_served;
+	}
+
+	pthread_mutex_lock(&stripe_lock);
+
+	for (i = 0; i < count; i++)
+	{
+		stripes[i].request = my_current;
+		stripes[i].next = NULL;
+		*stripe_tail = &stripes[i];
+		stripe_tail = &stripes[i].next;
+	}
+
+	pthread_cond_broadcast(&stripe_queued);
+	pthread_mutex_unlock(&stripe_lock);
+}
+
+/**
+ * Waits until count stripes handed out with stripe_submit() have been
+ * fetched, fetching those no worker has taken yet in the current thread
+ */
+static void stripe_wait(struct my_stripe *stripes, unsigned int count)
+{
+	struct my_stripe **link, *stripe;
+	unsigned int i;
+
+	pthread_mutex_lock(&stripe_lock);
+
+	for (;;)
+	{
+		//
+		// Take back the first stripe of the batch still in the queue
+		//
+
+		stripe = NULL;
+
+		for (link = &stripe_queue; *link != NULL; link = &(*link)->next)
+		{
+			if (*link >= stripes && *link < stripes + count)
+			{
+				stripe = *link;
+				*link = stripe->next;
+				if (stripe_tail == &stripe->next)
+				{
+					stripe_tail = link;
+				}
+				break;
+			}
+		}
+
+		if (stripe != NULL)
+		{
+			pthread_mutex_unlock(&stripe_lock);
+			my_fetch_stripe(stripe);
+			pthread_mutex_lock(&stripe_lock);
+
+			stripe->done = 1;
+			continue;
+		}
+
+		for (i = 0; i < count && stripes[i].done; i++);
+
+		if (i == count)
+		{
+			break;
+		}
+
+		pthread_cond_wait(&stripe_fetched, &stripe_lock);
+	}
+
+	pthread_mutex_unlock(&stripe_lock);
+}
+
+/**
+ * Fetches up to my_stripes consecutive stripes of a row of table with cache
+ * key name, read through view unless it is NULL, of size bytes, starting
+ * from stripe first, concurrently over several connections. Copies up to
+ * count bytes starting at byte within of the first stripe to buf and keeps
+ * the stripes in the cache, unless read through a view. Returns number of
+ * bytes copied or negated error code
+ */
+static int my_fetch_stripes(const struct my_table *table, const char *name,
+	const struct my_view *view, unsigned long long size,
+	unsigned long long first, char *buf, size_t count, unsigned long within)
+{
+	struct my_stripe *stripes;
+	unsigned long long total;
+	unsigned int i, n;
+	char key[STRIPE_KEY_MAX];
+	size_t copied, piece;
+	int result;
+
+	total = (size + my_stripe_size - 1) / my_stripe_size;
+
+	n = my_stripes ? my_stripes : 1;
+	if (first + n > total)
+	{
+		n = total - first;
+	}
+
+	stripes = (struct my_stripe*) calloc(n, sizeof(struct my_stripe));
+	if (stripes == NULL)
+	{
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		stripes[i].table = table;
+		stripes[i].name = name;
+		stripes[i].view = view;
+		stripes[i].index = first + i;
+		stripes[i].length = my_stripe_size;
+
+		if ((first + i + 1) * my_stripe_size > size)
+		{
+			stripes[i].length = size - (first + i) * my_stripe_size;
+		}
+	}
+
+	//
+	// Fetch the first stripe in this thread and hand the others to the
+	// stripe workers
+	//
+
+	if (n > 1)
+	{
+		stripe_submit(&stripes[1], n - 1);
+	}
+
+	my_fetch_stripe(&stripes[0]);
+
+	if (n > 1)
+	{
+		stripe_wait(&stripes[1], n - 1);
+	}
+
+	//
+	// Reassemble requested bytes in order and keep the stripes for
+	// following reads
+	//
+
+	result = stripes[0].result;
+	copied = 0;
+
+	for (i = 0; i < n && result == 0 && copied < count; i++)
+	{
+		if (stripes[i].result != 0 || within >= stripes[i].received)
+		{
+			break;
+		}
+
+		piece = stripes[i].received - within;
+		if (piece > count - copied)
+		{
+			piece = count - copied;
+		}
+
+		memcpy(buf + copied, stripes[i].data + within, piece);
+		copied += piece;
+		within = 0;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		if (stripes[i].result == 0 && view == NULL)
+		{
+			stripe_key(key, name, stripes[i].index);
+			cache_store(key, stripes[i].received, stripes[i].data, NULL, 0);
+		}
+
+		free(stripes[i].data);
+	}
+
+	free(stripes);
+
+	return result == 0 ? (int) copied : result;
+}
+
+/**
+ * Reads size bytes starting from offset of a row of table with cache key
+ * name, of row_size bytes, stripe by stripe, from the cache where possible.
+ * Rows read through a view must match its condition and bypass the cache.
+ * Returns number of bytes read or negated error code
+ */
+static int my_read_striped(const struct my_table *table, const char *name,
+	const struct my_view *view, unsigned long long row_size, char *buf, size_t size,
+	off_t offset)
+{
+	unsigned long long index;
+	unsigned long within;
+	size_t done;
+	char key[STRIPE_KEY_MAX];
+	int n;
+
+	if (offset >= row_size)
+	{
+		return 0;
+	}
+
+	if (offset + size > row_size)
+	{
+		size = row_size - offset;
+	}
+
+	done = 0;
+	n = 0;
+
+	while (done < size)
+	{
+		index = (offset + done) / my_stripe_size;
+		within = (offset + done) % my_stripe_size;
+
+		stripe_key(key, name, index);
+		n = view == NULL ? cache_read(key, buf + done, size - done, within) : -1;
+
+		if (n < 0)
+		{
+			n = my_fetch_stripes(table, name, view, row_size, index, buf + done,
+				size - done, within);
+		}
+
+		if (n <= 0)
+		{
+			break;
+		}
+
+		done += n;
+	}
+
+	return done > 0 || n == 0 ? (int) done : n;
+}
+
+/**
+ * Returns 0 if the row of file or row directory p exists, or negated error
+ * code
+ */
+static int my_exists(const struct my_path *p)
+{
+	char *query;
+	const char *cond;
+	size_t length;
+	int result;
+	struct my_conn *conn;
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+
+	//
+	// Query if file exists in the database
+	//
+
+	length = 0;
+	cond = path_condition(p);
+	query = cond != NULL ? query_build(&length, p->table, QUERY_EXISTS, cond) : NULL;
+
+	if (query == NULL)
+	{
+		return -ENOMEM;
+	}
+
+	conn = pool_acquire(MY_CLASS_META, key_server(p->name));
+	res = my_query(conn, p->table, QUERY_EXISTS, p->key, query);
+
+	if (res != NULL)
+	{
+
+		//
+		// Return if file exists
+		//
+
+		row = mysql_fetch_row(res);
+
+		if (row == NULL)
+		{
+			result = my_status(conn, -ENOENT);
+		}
+		else
+		{
+			result = 0;
+		}
+
+		mysql_free_result(res);
+	}
+	else
+	{
+		result = my_status(conn, -EAGAIN);
+	}
+
+	pool_release(conn);
+
+	return result;
+}
+
+/**
+ * Returns stat info of the specified file
+ *
+ * TODO: For memory/connection errors use error code other than -ENOENT
+ */
+static int my_getattr(const char *path, struct stat *stbuf)
+{
+	char *query, *xattrs;
+	const char *cond;
+	size_t length;
+	int result;
+	unsigned long size, xattrs_size;
+	struct my_conn *conn;
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+	struct my_path p;
+
+	if (!path_resolve(path, &p))
+	{
+		return -ENOENT;
+	}
+
+	memset(stbuf, 0, sizeof(struct stat));
+
+	//
+	// Path points to a directory, use its static attributes. A row directory
+	// has to have its row
+	//
+
+	if (p.kind == PATH_ROW && (result = my_exists(&p)) != 0)
+	{
+		return result;
+	}
+
+	if (p.kind != PATH_FILE)
+	{
+		stbuf->st_mode = S_IFDIR | 0555;
+		stbuf->st_nlink = 2;
+		stbuf->st_uid = getuid();
+		stbuf->st_gid = getgid();
+		return 0;
+	}
+
+	//
+	// Path points to one of the files, try to get its size from the cache.
+	// Files of views are always looked up, the cache does not tell if their
+	// rows match
+	//
+
+	if (p.view == NULL && cache_get_attr(p.key, &size))
+	{
+		stbuf->st_mode = S_IFREG | 0555;
+		stbuf->st_nlink = 1;
+		stbuf->st_size = size;
+		stbuf->st_uid = getuid();
+		stbuf->st_gid = getgid();
+		return 0;
+	}
+
+	//
+	// A recent listing tells if a file does not exist
+	//
+
+	if (name_lookup(p.table, p.name) == 0)
+	{
+		return -ENOENT;
+	}
+
+	//
+	// Get its attributes from the database
+	//
+
+	length = 0;
+	cond = path_condition(&p);
+	query = cond != NULL ? query_build(&length, p.table, QUERY_ATTR, p.column, cond) : NULL;
+
+	if (query == NULL)
+	{
+		return -ENOMEM;
+	}
+
+	result = 0;
+	xattrs = NULL;
+
+	conn = pool_acquire(MY_CLASS_META, key_server(p.name));
+	res = my_query(conn, p.table, QUERY_ATTR, p.key, query);
+
+	if (res != NULL)
+	{
+
+		//
+		// If specified filename has a corresponding row in the
+		// database, return its information. Else, report that
+		// there is no such file, as for a NULL field
+		//
+
+		row = mysql_fetch_row(res);
+
+		if (row != NULL && row[0] != NULL)
+		{
+			conn->rows = 1;
+			stbuf->st_mode = S_IFREG | 0555;
+			stbuf->st_nlink = 1;
+			stbuf->st_size = atoi(row[0]);
+			stbuf->st_uid = getuid();
+			stbuf->st_gid = getgid();
+
+			//
+			// Extended attribute fields come along, they are kept in
+			// the cache with the size
+			//
+
+			xattrs = xattrs_pack(row, mysql_fetch_lengths(res), 1, &xattrs_size);
+		}
+		else
+		{
+			result = my_status(conn, -ENOENT);
+		}
+
+		mysql_free_result(res);
+	}
+	else
+	{
+		result = my_status(conn, -ENOENT);
+	}
+
+	pool_release(conn);
+
+	if (result == 0)
+	{
+		cache_store(p.key, stbuf->st_size, NULL, xattrs, xattrs_size);
+	}
+
+	return result;
+}
+
+/**
+ * Sends query of kind on table to every server rows are split across,
+ * concurrently over one connection to each, and returns their listings, to be read in name order with
+ * my_list_next() and closed with my_list_close(). Returns NULL if out of
+ * memory
+ */
+static struct my_listing *my_list_open(const struct my_table *table,
+	enum my_query_kind kind, const char *query)
+{
+	struct my_listing *listings;
+	unsigned int i;
+
+	listings = (struct my_listing*) calloc(my_server_count, sizeof(struct my_listing));
+	if (listings == NULL)
+	{
+		return NULL;
+	}
+
+	//
+	// Connections are taken in server order, so that concurrent listings
+	// never hold one each of the connections the other waits for
+	//
+
+	for (i = 0; i < my_server_count; i++)
+	{
+		listings[i].conn = pool_acquire(MY_CLASS_META, i);
+	}
+
+	//
+	// Send the query to all servers before reading any answer, so that they
+	// run it at the same time, then read the first row of every result
+	//
+
+	for (i = 0; i < my_server_count; i++)
+	{
+		listings[i].result = my_query_send(listings[i].conn, table, kind, NULL, query) ?
+			0 : my_status(listings[i].conn, -ENOENT);
+	}
+
+	for (i = 0; i < my_server_count; i++)
+	{
+		if (listings[i].result != 0)
+		{
+			continue;
+		}
+
+		listings[i].res = my_query_result(listings[i].conn);
+
+		if (listings[i].res != NULL)
+		{
+			listings[i].row = mysql_fetch_row(listings[i].res);
+		}
+		else
+		{
+			listings[i].result = my_status(listings[i].conn, -ENOENT);
+		}
+	}
+
+	return listings;
+}
+
+/**
+ * Compares two row names the way listings are ordered: numerically, or
+ * bytewise for string names
+ */
+static int list_compare(const char *a, const char *b)
+{
+	unsigned long long x, y;
+
+	if (a == NULL || b == NULL)
+	{
+		return (b == NULL) - (a == NULL);
+	}
+
+	if (my_string_keys)
+	{
+		return strcmp(a, b);
+	}
+
+	x = strtoull(a, NULL, 10);
+	y = strtoull(b, NULL, 10);
+
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * Returns the row with the lowest name among the current rows of all
+ * listings, or NULL once all of them are exhausted. The row stays valid
+ * until the next call
+ */
+static MYSQL_ROW my_list_next(struct my_listing *listings)
+{
+	struct my_listing *best;
+	unsigned int i;
+
+	best = NULL;
+
+	for (i = 0; i < my_server_count; i++)
+	{
+		if (listings[i].consumed)
+		{
+			listings[i].row = mysql_fetch_row(listings[i].res);
+			listings[i].consumed = 0;
+		}
+
+		if (listings[i].row != NULL &&
+			(best == NULL || list_compare(listings[i].row[0], best->row[0]) < 0))
+		{
+			best = &listings[i];
+		}
+	}
+
+	if (best == NULL)
+	{
+		return NULL;
+	}
+
+	best->conn->rows++;
+	best->consumed = 1;
+
+	return best->row;
+}
+
+/**
+ * Frees the results of all listings and returns their connections to the
+ * pool. Returns 0 if every server answered or negated error code
+ */
+static int my_list_close(struct my_listing *listings)
+{
+	unsigned int i;
+	int result, status;
+
+	result = 0;
+
+	for (i = 0; i < my_server_count; i++)
+	{
+		if (listings[i].res != NULL)
+		{
+			mysql_free_result(listings[i].res);
+		}
+
+		status = listings[i].res != NULL ? my_status(listings[i].conn, 0) :
+			listings[i].result;
+
+		if (result == 0)
+		{
+			result = status;
+		}
+
+		pool_release(listings[i].conn);
+	}
+
+	free(listings);
+
+	return result;
+}
+
+/**
+ * Lists partition directories of table, from the one holding the lowest row name to
+ * the one holding the highest. Partitions in between are listed whether they
+ * have rows or not; their rows are only queried when they are listed
+ */
+static int my_readdir_partitions(const struct my_table *table, void *buf,
+	fuse_fill_dir_t filler)
+{
+	char *query;
+	size_t length;
+	struct my_listing *listings;
+	MYSQL_ROW row;
+	unsigned long long first, last, lo, hi, i;
+	my_bool empty;
+	char name[48];
+	int result;
+
+	length = 0;
+	query = query_build(&length, table, QUERY_BOUNDS);
+	listings = query != NULL ? my_list_open(table, QUERY_BOUNDS, query) : NULL;
+
+	if (listings == NULL)
+	{
+		return -ENOMEM;
+	}
+
+	//
+	// Bounds of the whole table are the lowest and highest bounds of all
+	// servers. Servers holding no rows return NULL bounds
+	//
+
+	empty = 1;
+	first = last = 0;
+
+	while ((row = my_list_next(listings)) != NULL)
+	{
+		if (row[0] == NULL || row[1] == NULL)
+		{
+			continue;
+		}
+
+		lo = strtoull(row[0], NULL, 10);
+		hi = strtoull(row[1], NULL, 10);
+
+		if (empty || lo < first)
+		{
+			first = lo;
+		}
+
+		if (empty || hi > last)
+		{
+			last = hi;
+		}
+
+		empty = 0;
+	}
+
+	result = my_list_close(listings);
+
+	if (result == 0 && !empty)
+	{
+		for (i = first / my_partition_size; i <= last / my_partition_size; i++)
+		{
+			sprintf(name, "%llu-%llu", i * my_partition_size,
+				(i + 1) * my_partition_size - 1);
+			filler(buf, name, NULL, 0);
+		}
+	}
+
+	return result;
+}
+
+/**
+ * Lists a directory whose rows are selected by a condition: a view, listing
+ * the names of rows matching it, or a directory of a table with a composite
+ * key, listing the distinct values of the next key field among rows below
+ * it, or the row names if it is the last directory level. Values that cannot
+ * be file names are left out
+ */
+static int my_readdir_where(const struct my_path *p, void *buf, fuse_fill_dir_t filler)
+{
+	char *query;
+	const char *cond;
+	size_t length;
+	struct my_listing *listings;
+	MYSQL_ROW row;
+	enum my_query_kind kind;
+	const char *field;
+
+	field = p->table->fields[p->depth];
+	kind = p->view == NULL && p->depth < p->table->levels ? QUERY_LEVEL : QUERY_FILES;
+
+	length = 0;
+	cond = p->view != NULL ? p->view->condition : key_condition(p->table, p->name);
+	query = cond == NULL ? NULL : kind == QUERY_LEVEL ?
+		query_build(&length, p->table, kind, field, cond, field) :
+		query_build(&length, p->table, kind, cond);
+	listings = query != NULL ? my_list_open(p->table, kind, query) : NULL;
+
+	if (listings == NULL)
+	{
+		return -ENOMEM;
+	}
+
+	while ((row = my_list_next(listings)) != NULL)
+	{
+		if (row[0] != NULL && is_valid_key(row[0]))
+		{
+			filler(buf, row[0], NULL, 0);
+		}
+	}
+
+	return my_list_close(listings);
+}
+
+/**
+ * Returns list of all files in the specified directory. Shard directories
+ * above the last level list every possible child, the others list the rows
+ * whose names fall into their range
+ */
+static int my_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+	off_t offset, struct fuse_file_info *fi)
+{
+	char *query;
+	size_t length;
+	struct my_listing *listings;
+	MYSQL_ROW row;
+	my_bool hints;
+	int result;
+	struct my_path p;
+	enum my_query_kind kind;
+	unsigned long long count, i;
+	char name[24], *names;
+	size_t names_length, names_size;
+	unsigned long names_count;
+	unsigned long long *hint_buf;
+	unsigned int hint_length, hint_size;
+
+	//
+	// Make sure that a directory was requested
+	//
+
+	if (!path_resolve(path, &p))
+	{
+		return -ENOENT;
+	}
+
+	if (p.kind == PATH_FILE)
+	{
+		return -ENOTDIR;
+	}
+
+	//
+	// Add two virtual directories: "." and "..", and the partition
+	// and view directories to the root
+	//
+
+	filler(buf, ".", NULL, 0);
+	filler(buf, "..", NULL, 0);
+
+	if (my_partition_size > 0 && p.root)
+	{
+		filler(buf, PARTITION_DIR + 1, NULL, 0);
+	}
+
+	if (p.root && table_has_views(p.table))
+	{
+		filler(buf, VIEW_DIR + 1, NULL, 0);
+	}
+
+	if (p.kind == PATH_PARTITIONS)
+	{
+		return my_readdir_partitions(p.table, buf, filler);
+	}
+
+	//
+	// Root directory holding tables lists them
+	//
+
+	if (p.kind == PATH_TABLES)
+	{
+		for (i = 0; i < my_table_count; i++)
+		{
+			filler(buf, my_tables[i].table, NULL, 0);
+		}
+
+		return 0;
+	}
+
+	//
+	// Row directory lists the data fields of its table
+	//
+
+	if (p.kind == PATH_ROW)
+	{
+		for (i = 0; i < p.table->column_count; i++)
+		{
+			filler(buf, p.table->columns[i], NULL, 0);
+		}
+
+		return 0;
+	}
+
+	//
+	// View directory lists the views of its table
+	//
+
+	if (p.kind == PATH_VIEWS)
+	{
+		for (i = 0; i < my_view_count; i++)
+		{
+			if (my_views[i].table == p.table)
+			{
+				filler(buf, my_views[i].name, NULL, 0);
+			}
+		}
+
+		return 0;
+	}
+
+	//
+	// Views and directories of composite keys list rows matching a
+	// condition. Their listings are neither hints nor a name index, which
+	// cover whole tables
+	//
+
+	if (p.view != NULL || p.table->levels > 0)
+	{
+		return my_readdir_where(&p, buf, filler);
+	}
+
+	//
+	// Shard directories above the last level hold every possible child,
+	// there is no need to ask the server about them
+	//
+
+	if (!p.partition && p.depth < my_shard_levels)
+	{
+		count = pow10_ull(my_shard_digits);
+
+		for (i = 0; i < count; i++)
+		{
+			sprintf(name, "%0*llu", (int) my_shard_digits, i);
+			filler(buf, name, NULL, 0);
+		}
+
+		return 0;
+	}
+
+	//
+	// Query list of files from the database, only those within the range of
+	// the directory, if it has one, merging the lists of all servers
+	//
+
+	length = 0;
+	kind = p.ranged ? QUERY_RANGE : QUERY_LIST;
+	query = p.ranged ? query_build(&length, p.table, kind, p.lo, p.hi) :
+		query_build(&length, p.table, kind);
+
+	listings = query != NULL ? my_list_open(p.table, kind, query) : NULL;
+
+	if (listings != NULL)
+	{
+		//
+		// Remember the listing order, so that files opened afterwards
+		// can be prefetched along with their neighbours. The names are
+		// collected aside and replace the hints once the listing is read
+		//
+
+		hints = my_prefetch > 1 && !my_string_keys;
+		hint_buf = NULL;
+		hint_length = hint_size = 0;
+
+		//
+		// String names are collected into the name index instead, which
+		// also serves lookups of missing files
+		//
+
+		names_length = names_count = 0;
+		names_size = BUF_MIN;
+		names = my_string_keys ? (char*) malloc(names_size) : NULL;
+
+		while ((row = my_list_next(listings)) != NULL)
+		{
+			if (my_string_keys)
+			{
+				//
+				// Names that cannot be file names are left out
+				//
+
+				if (!is_valid_key(row[0]))
+				{
+					continue;
+				}
+
+				name_collect(&names, &names_length, &names_size, row[0]);
+				names_count++;
+			}
+
+			if (p.ranged && !p.partition)
+			{
+				sprintf(name, "%0*llu", (int) my_shard_width,
+					strtoull(row[0], NULL, 10));
+				filler(buf, name, NULL, 0);
+			}
+			else
+			{
+				filler(buf, row[0], NULL, 0);
+			}
+
+			if (hints)
+			{
+				hint_add(&hint_buf, &hint_length, &hint_size, row[0]);
+			}
+		}
+
+		if (hints)
+		{
+			hint_set(p.table, hint_buf, hint_length);
+		}
+
+		//
+		// Names only make an index if every server listed its rows
+		//
+
+		result = my_list_close(listings);
+
+		if (names != NULL)
+		{
+			if (result == 0)
+			{
+				name_index_build(p.table, names, names_length, names_count);
+			}
+
+			free(names);
+		}
+	}
+	else
+	{
+		result = -ENOMEM;
+	}
+
+	return result;
+} 
+
+/**
+ * Allows to open directory "/" and files inside it, which have corresponding
+ * rows
+ */
+static int my_open(const char* path, struct fuse_file_info *fi)
+{
+	int result;
+	unsigned long size;
+	struct my_path p;
+
+	//
+	// Check for path validity and disallow write requests
+	//
+
+	if (!path_resolve(path, &p))
+	{
+		return -ENOENT;
+	}
+
+	if (fi->flags & O_RDONLY == 0)
+	{
+		return -EROFS;
+	}
+
+	//
+	// Path points to a directory, allow to open it
+	//
+
+	if (p.kind != PATH_FILE)
+	{
+		return 0;
+	}
+
+	//
+	// If prefetching is enabled, fetch the file together with the ones that
+	// are likely to be opened next, unless an earlier batch brought it
+	// along already. This also tells whether it exists, as does a recent
+	// listing
+	//
+
+	if (name_lookup(p.table, p.name) == 0)
+	{
+		return -ENOENT;
+	}
+
+	if (my_prefetch > 0 && p.view == NULL)
+	{
+		if (cache_covers(p.key))
+		{
+			return 0;
+		}
+
+		result = my_prefetch_from(p.table, p.key);
+		if (result == 0)
+		{
+			return cache_get_size(p.key, &size) ? 0 : -ENOENT;
+		}
+	}
+
+	return my_exists(&p);
+}
+
+/**
+ * Returns size bytes from the file identified by path, starting from byte offset 
+ *
+ * TODO: chop the desired block of data using SQL, rather than on the client side
+ */
+static int my_read(const char *path, char *buf, size_t size, off_t offset,
+  struct fuse_file_info *fi)
+{
+	char *query;
+	const char *cond;
+	size_t length;
+	unsigned long *lengths, len;
+	int result;
+	struct stat st;
+	struct my_conn *conn;
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+	struct my_path p;
+
+	//
+	// Check if path is valid and points to a file
+	//
+
+	if (!path_resolve(path, &p))
+	{
+		return -ENOENT;
+	}
+
+	if (p.kind != PATH_FILE)
+	{
+		return -EISDIR;
+	}
+
+	//
+	// Serve the request from the cache, if file content is there. Files of
+	// views are not cached, as the row may have stopped matching the view
+	//
+
+	result = p.view == NULL ? cache_read(p.key, buf, size, offset) : -1;
+	if (result >= 0)
+	{
+		return result;
+	}
+
+	//
+	// Large files are read in stripes, several of them at once over
+	// separate connections
+	//
+
+	if (my_stripe_size > 0)
+	{
+		result = my_getattr(path, &st);
+		if (result != 0)
+		{
+			return result;
+		}
+
+		if (st.st_size > my_stripe_size)
+		{
+			return my_read_striped(p.table, p.key, p.view, st.st_size, buf, size, offset);
+		}
+	}
+
+	//
+	// Query file content from the database
+	//
+
+	length = 0;
+	cond = path_condition(&p);
+	query = cond != NULL ? query_build(&length, p.table, QUERY_FETCH, p.column, cond) : NULL;
+
+	if (query == NULL)
+	{
+		return -ENOMEM;
+	}
+
+	conn = pool_acquire(MY_CLASS_READ, key_server(p.name));
+	res = my_query(conn, p.table, QUERY_FETCH, p.key, query);
+
+	if (res != NULL)
+	{
+		//
+		// Copy part of the file, specified by offset and size
+		//
+
+		row = mysql_fetch_row(res);
+		if (row != NULL)
+		{
+			lengths = mysql_fetch_lengths(res);
+			len = lengths[0];
+			conn->received = len;
+			conn->rows = 1;
+
+			//
+			// Keep small files around, so that following reads
+			// do not fetch them again
+			//
+
+			if (len <= my_prefetch_max_size && p.view == NULL)
+			{
+				cache_store(p.key, len, row[0], NULL, 0);
+			}
+
+			if (offset <= len)
+			{
+				if (offset + size > len)
+				{
+					size = len - offset;
+				}
+
+				memcpy(buf, row[0] + offset, size);
+			}
+			else
+			{
+				size = 0;
+			}
+		}
+		else
+		{
+			size = my_status(conn, -ENOENT);
+		}
+
+		mysql_free_result(res);
+	}
+	else
+	{
+		size = my_status(conn, -ENOMEM);
+	}
+
+	pool_release(conn);
+
+	return size;
+}
+
+/**
+ * Returns a copy of the packed extended attributes of file p at path, to be
+ * freed by the caller, with their size in *size. They are taken from the
+ * cache, where my_getattr() puts them if they are not there yet, or if the
+ * file is in a view. Returns NULL and stores negated error code in *result
+ * on failure
+ */
+static char *my_xattrs(const char *path, const struct my_path *p, unsigned long *size,
+	int *result)
+{
+	struct stat st;
+	char *xattrs;
+
+	xattrs = p->view == NULL ? cache_get_xattrs(p->key, size) : NULL;
+
+	if (xattrs == NULL)
+	{
+		if ((*result = my_getattr(path, &st)) != 0)
+		{
+			return NULL;
+		}
+
+		xattrs = cache_get_xattrs(p->key, size);
+	}
+
+	*result = xattrs != NULL ? 0 : -ENOMEM;
+
+	return xattrs;
+}
+
+/**
+ * Copies extended attribute value of len bytes into buf of size bytes, or
+ * only returns its length if size is 0. Returns the length or negated error
+ * code
+ */
+static int xattr_copy(const char *v, unsigned long len, char *buf, size_t size)
+{
+	if (size == 0)
+	{
+		return len;
+	}
+
+	if (size < len)
+	{
+		return -ERANGE;
+	}
+
+	memcpy(buf, v, len);
+
+	return len;
+}
+
+/**
+ * Returns content checksum of file p, computed by the server unless it is
+ * in the cache, as the value of an extended attribute
+ */
+static int my_getchecksum(const struct my_path *p, char *value, size_t size)
+{
+	char *query, *checksum;
+	const char *cond;
+	size_t length;
+	int result;
+	struct my_conn *conn;
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+
+	checksum = p->view == NULL ? cache_get_checksum(p->key) : NULL;
+
+	if (checksum != NULL)
+	{
+		result = xattr_copy(checksum, strlen(checksum), value, size);
+		free(checksum);
+		return result;
+	}
+
+	//
+	// Have the server compute it, so that content is not transferred
+	//
+
+	length = 0;
+	cond = path_condition(p);
+	query = cond != NULL ? query_build(&length, p->table, QUERY_CHECKSUM, p->column, cond) : NULL;
+
+	if (query == NULL)
+	{
+		return -ENOMEM;
+	}
+
+	conn = pool_acquire(MY_CLASS_READ, key_server(p->name));
+	res = my_query(conn, p->table, QUERY_CHECKSUM, p->key, query);
+
+	if (res != NULL)
+	{
+		row = mysql_fetch_row(res);
+
+		if (row == NULL)
+		{
+			result = my_status(conn, -ENOENT);
+		}
+		else if (row[0] == NULL)
+		{
+			result = -ENODATA;
+		}
+		else
+		{
+			conn->rows = 1;
+			cache_set_checksum(p->key, row[0]);
+			result = xattr_copy(row[0], strlen(row[0]), value, size);
+		}
+
+		mysql_free_result(res);
+	}
+	else
+	{
+		result = my_status(conn, -EIO);
+	}
+
+	pool_release(conn);
+
+	return result;
+}
+
+/**
+ * Returns value of extended attribute name of a file: one of the extended
+ * attribute fields, or the content checksum. Files with a NULL field, and
+ * directories, do not have the attribute
+ */
+static int my_getxattr(const char *path, const char *name, char *value, size_t size)
+{
+	char *xattrs;
+	const char *v;
+	unsigned long xattrs_size, len;
+	unsigned int i;
+	int result;
+	struct my_path p;
+
+	if (!path_resolve(path, &p))
+	{
+		return -ENOENT;
+	}
+
+	if (p.kind != PATH_FILE)
+	{
+		return -ENODATA;
+	}
+
+	if (my_checksum != NULL && strcmp(name, my_checksum_xattr) == 0)
+	{
+		return my_getchecksum(&p, value, size);
+	}
+
+	for (i = 0; i < my_xattr_count; i++)
+	{
+		if (strcmp(name, my_xattr_names[i]) == 0)
+		{
+			break;
+		}
+	}
+
+	if (i == my_xattr_count)
+	{
+		return -ENODATA;
+	}
+
+	if ((xattrs = my_xattrs(path, &p, &xattrs_size, &result)) == NULL)
+	{
+		return result;
+	}
+
+	//
+	// Size 0 asks for the size of the value only
+	//
+
+	len = xattrs_value(xattrs, i, &v);
+	result = len != ULONG_MAX ? xattr_copy(v, len, value, size) : -ENODATA;
+
+	free(xattrs);
+
+	return result;
+}
+
+/**
+ * Returns the names of extended attributes of a file, each followed by a
+ * zero byte: those of the extended attribute fields that are not NULL, and
+ * that of the content checksum, if it is computed by the server
+ */
+static int my_listxattr(const char *path, char *list, size_t size)
+{
+	char *xattrs;
+	const char *v;
+	unsigned long xattrs_size;
+	unsigned int i;
+	size_t len;
+	int result;
+	struct my_path p;
+
+	if (!path_resolve(path, &p))
+	{
+		return -ENOENT;
+	}
+
+	if (p.kind != PATH_FILE)
+	{
+		return 0;
+	}
+
+	len = 0;
+
+	if (my_checksum != NULL)
+	{
+		if (size > 0 && strlen(my_checksum_xattr) + 1 <= size)
+		{
+			strcpy(list, my_checksum_xattr);
+		}
+
+		len += strlen(my_checksum_xattr) + 1;
+	}
+
+	if (my_xattr_count == 0)
+	{
+		return size > 0 && len > size ? -ERANGE : (int) len;
+	}
+
+	if ((xattrs = my_xattrs(path, &p, &xattrs_size, &result)) == NULL)
+	{
+		return result;
+	}
+
+	for (i = 0; i < my_xattr_count; i++)
+	{
+		if (xattrs_value(xattrs, i, &v) == ULONG_MAX)
+		{
+			continue;
+		}
+
+		if (size > 0 && len + strlen(my_xattr_names[i]) + 1 <= size)
+		{
+			strcpy(list + len, my_xattr_names[i]);
+		}
+
+		len += strlen(my_xattr_names[i]) + 1;
+	}
+
+	free(xattrs);
+
+	return size > 0 && len > size ? -ERANGE : (int) len;
+}
+
+/**
+ * Returns if path belongs to the hidden directory with virtual files
+ */
+static my_bool is_virtual_path(const char *path)
+{
+	return strncmp(path, VFS_DIR, strlen(VFS_DIR)) == 0 &&
+		(path[strlen(VFS_DIR)] == '\0' || path[strlen(VFS_DIR)] == '/');
+}
+
+/**
+ * Returns stat info of the hidden directory and virtual files inside it. Their
+ * content is generated when they are opened, so their size is reported as 0
+ */
+static int vfs_getattr(const char *path, struct stat *stbuf)
+{
+	memset(stbuf, 0, sizeof(struct stat));
+
+	stbuf->st_uid = getuid();
+	stbuf->st_gid = getgid();
+
+	if (strcmp(path, VFS_DIR) == 0)
+	{
+		stbuf->st_mode = S_IFDIR | 0555;
+		stbuf->st_nlink = 2;
+		return 0;
+	}
+
+	if (strcmp(path, VFS_STATS) == 0)
+	{
+		stbuf->st_mode = S_IFREG | 0444;
+		stbuf->st_nlink = 1;
+		return 0;
+	}
+
+	if (strcmp(path, VFS_CONTROL) == 0)
+	{
+		stbuf->st_mode = S_IFREG | 0644;
+		stbuf->st_nlink = 1;
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+/**
+ * Lists virtual files
+ */
+static int vfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler)
+{
+	if (strcmp(path, VFS_DIR) != 0)
+	{
+		return -ENOTDIR;
+	}
+
+	filler(buf, ".", NULL, 0);
+	filler(buf, "..", NULL, 0);
+	filler(buf, VFS_STATS + strlen(VFS_DIR) + 1, NULL, 0);
+	filler(buf, VFS_CONTROL + strlen(VFS_DIR) + 1, NULL, 0);
+
+	return 0;
+}
+
+/**
+ * Returns current values of the settings that can be changed through the
+ * control file, in the form they are written to it
+ */
+static char *control_format(void)
+{
+	struct control_setting *setting;
+	char *text, *p;
+
+	text = (char*) malloc(64 * (sizeof(control_settings) / sizeof(control_settings[0]) + 3));
+	if (text == NULL)
+	{
+		return NULL;
+	}
+
+	p = text;
+	p += sprintf(p, "cache-size %lu\n", cache_budget >> 20);
+	p += sprintf(p, "pool-size %u\n", pool_size);
+	p += sprintf(p, "reserved %u\n", pool_reserved);
+
+	for (setting = control_settings; setting->name != NULL; setting++)
+	{
+		p += sprintf(p, "%s %u\n", setting->name, *setting->value);
+	}
+
+	return text;
+}
+
+/**
+ * Returns the table whose row a word of a control command names, or NULL if
+ * it names none. Rows are named by their cache keys: with the directory of
+ * their table in front, if tables are mounted as subdirectories, and the data
+ * field, if the table has several
+ */
+static struct my_table *control_table(const char *word)
+{
+	const char *name, *column;
+	unsigned int i;
+
+	for (i = 0; i < my_table_count; i++)
+	{
+		if (strncmp(word, my_tables[i].prefix, strlen(my_tables[i].prefix)) == 0 &&
+			(name = key_split(&my_tables[i], word, &column)) != NULL &&
+			is_valid_row(&my_tables[i], name))
+		{
+			return &my_tables[i];
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Applies one command line written to the control file. Returns 0 on
+ * success or negated error code
+ */
+static int control_apply(char *line)
+{
+	struct control_setting *setting;
+	char *words[CONTROL_WORDS], *batch[CONTROL_WORDS], *word, *save;
+	unsigned int count, i, t, n, value;
+	int result;
+
+	count = 0;
+
+	for (word = strtok_r(line, " \t\r", &save); word != NULL; word = strtok_r(NULL, " \t\r", &save))
+	{
+		if (count == CONTROL_WORDS)
+		{
+			return -E2BIG;
+		}
+
+		words[count++] = word;
+	}
+
+	if (count == 0 || words[0][0] == '#')
+	{
+		return 0;
+	}
+
+	//
+	// Cache maintenance: drop rows (with their stripes) or the whole
+	// cache, or fetch rows into it ahead of use
+	//
+
+	if (strcmp(words[0], "drop-all") == 0 && count == 1)
+	{
+		cache_drop(NULL);
+		return 0;
+	}
+
+	if (strcmp(words[0], "drop") == 0 || strcmp(words[0], "warm") == 0)
+	{
+		if (count < 2)
+		{
+			return -EINVAL;
+		}
+
+		for (i = 1; i < count; i++)
+		{
+			if (control_table(words[i]) == NULL)
+			{
+				return -EINVAL;
+			}
+		}
+
+		//
+		// Rows are warmed with one pipelined query per table
+		//
+
+		if (words[0][0] == 'w')
+		{
+			for (t = 0; t < my_table_count; t++)
+			{
+				n = 0;
+
+				for (i = 1; i < count; i++)
+				{
+					if (control_table(words[i]) == &my_tables[t])
+					{
+						batch[n++] = words[i];
+					}
+				}
+
+				result = n > 0 ? my_fetch_pipelined(&my_tables[t], batch, n,
+					MY_CLASS_PREFETCH) : 0;
+
+				if (result != 0)
+				{
+					return result;
+				}
+			}
+
+			return 0;
+		}
+
+		for (i = 1; i < count; i++)
+		{
+			cache_drop(words[i]);
+		}
+
+		return 0;
+	}
+
+	//
+	// Settings
+	//
+
+	if (count != 2 || !is_uint(words[1]))
+	{
+		return -EINVAL;
+	}
+
+	value = strtoul(words[1], NULL, 10);
+
+	if (strcmp(words[0], "cache-size") == 0)
+	{
+		cache_resize((unsigned long) value << 20);
+		return 0;
+	}
+
+	if (strcmp(words[0], "pool-size") == 0 || strcmp(words[0], "reserved") == 0)
+	{
+		pthread_mutex_lock(&pool_lock);
+
+		if (words[0][0] == 'p')
+		{
+			pool_size = value ? value : 1;
+		}
+		else
+		{
+			pool_reserved = value;
+		}
+
+		if (pool_reserved >= pool_size)
+		{
+			pool_reserved = pool_size - 1;
+		}
+
+		pthread_cond_broadcast(&pool_cond);
+		pthread_mutex_unlock(&pool_lock);
+
+		return 0;
+	}
+
+	for (setting = control_settings; setting->name != NULL; setting++)
+	{
+		if (strcmp(words[0], setting->name) == 0)
+		{
+			__atomic_store_n(setting->value, value, __ATOMIC_RELAXED);
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+/**
+ * Collects text written to the control file into lines and applies each one
+ * as it completes
+ */
+static int vfs_write(const char *buf, size_t size, struct fuse_file_info *fi)
+{
+	struct vfs_file *file = (struct vfs_file*) (uintptr_t) fi->fh;
+	size_t i, len;
+	int result;
+
+	if (file == NULL || !file->writing)
+	{
+		return -EBADF;
+	}
+
+	len = strlen(file->text);
+
+	for (i = 0; i < size; i++)
+	{
+		if (buf[i] == '\n')
+		{
+			result = control_apply(file->text);
+
+			len = 0;
+			file->text[0] = '\0';
+
+			if (result != 0)
+			{
+				return result;
+			}
+		}
+		else if (buf[i] == '\0' || len == CONTROL_LINE_MAX)
+		{
+			return -EINVAL;
+		}
+		else
+		{
+			file->text[len++] = buf[i];
+			file->text[len] = '\0';
+		}
+	}
+
+	return size;
+}
+
+/**
+ * Applies the last command written to the control file if it was not
+ * terminated by a newline
+ */
+static int vfs_flush(struct fuse_file_info *fi)
+{
+	struct vfs_file *file = (struct vfs_file*) (uintptr_t) fi->fh;
+	int result;
+
+	if (file == NULL || !file->writing || file->text[0] == '\0')
+	{
+		return 0;
+	}
+
+	result = control_apply(file->text);
+	file->text[0] = '\0';
+
+	return result;
+}
+
+/**
+ * Opens a virtual file, taking a snapshot of its content. The content is
+ * attached to the file handle and read with direct I/O, as its size is not
+ * known in advance. The control file may also be opened for writing by the
+ * user who mounted the file system
+ */
+static int vfs_open(const char *path, struct fuse_file_info *fi)
+{
+	struct vfs_file *file;
+	struct fuse_context *ctx;
+	my_bool writing;
+
+	if (strcmp(path, VFS_DIR) == 0)
+	{
+		return 0;
+	}
+
+	if (strcmp(path, VFS_STATS) != 0 && strcmp(path, VFS_CONTROL) != 0)
+	{
+		return -ENOENT;
+	}
+
+	writing = (fi->flags & O_ACCMODE) == O_WRONLY;
+
+	if ((fi->flags & O_ACCMODE) != O_RDONLY && !(writing && strcmp(path, VFS_CONTROL) == 0))
+	{
+		return strcmp(path, VFS_STATS) == 0 ? -EROFS : -EINVAL;
+	}
+
+	if (writing)
+	{
+		ctx = fuse_get_context();
+		if (ctx->uid != 0 && ctx->uid != getuid())
+		{
+			return -EACCES;
+		}
+	}
+
+	file = (struct vfs_file*) malloc(sizeof(struct vfs_file));
+	if (file == NULL)
+	{
+		return -ENOMEM;
+	}
+
+	file->writing = writing;
+
+	if (writing)
+	{
+		file->text = (char*) calloc(CONTROL_LINE_MAX + 1, 1);
+	}
+	else
+	{
+		file->text = strcmp(path, VFS_STATS) == 0 ? stats_format() : control_format();
+	}
+
+	if (file->text == NULL)
+	{
+		free(file);
+		return -ENOMEM;
+	}
+
+	fi->fh = (uint64_t) (uintptr_t) file;
+	fi->direct_io = 1;
+
+	return 0;
+}
+
+/**
+ * Reads from a virtual file snapshot
+ */
+static int vfs_read(char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	struct vfs_file *file = (struct vfs_file*) (uintptr_t) fi->fh;
+	size_t len;
+
+	if (file == NULL)
+	{
+		return -EISDIR;
+	}
+
+	if (file->writing)
+	{
+		return -EBADF;
+	}
+
+	len = strlen(file->text);
+
+	if (offset >= len)
+	{
+		return 0;
+	}
+
+	if (offset + size > len)
+	{
+		size = len - offset;
+	}
+
+	memcpy(buf, file->text + offset, size);
+
+	return size;
+}
+
+/**
+ * Entry points registered with FUSE. They record operation statistics and
+ * route requests for the hidden directory to virtual files
+ */
+static int op_getattr(const char *path, struct stat *stbuf)
+{
+	struct timespec start;
+	int result;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	MY_PROBE(getattr_entry, path);
+
+	result = is_virtual_path(path) ? vfs_getattr(path, stbuf) : my_getattr(path, stbuf);
+
+	stats_op(OP_GETATTR, &start, result);
+
+	if (!is_virtual_path(path))
+	{
+		record_op(RECORD_GETATTR, path, &start, 0, 0, result);
+	}
+
+	MY_PROBE(getattr_return, path, result);
+
+	return result;
+}
+
+static int op_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+	off_t offset, struct fuse_file_info *fi)
+{
+	struct timespec start;
+	int result;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	MY_PROBE(readdir_entry, path);
+
+	result = is_virtual_path(path) ? vfs_readdir(path, buf, filler) :
+		my_readdir(path, buf, filler, offset, fi);
+
+	stats_op(OP_READDIR, &start, result);
+
+	if (!is_virtual_path(path))
+	{
+		record_op(RECORD_READDIR, path, &start, 0, 0, result);
 	}
-	else
+
+	MY_PROBE(readdir_return, path, result);
+
+	return result;
+}
+
+static int op_open(const char *path, struct fuse_file_info *fi)
+{
+	struct timespec start;
+	int result;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	MY_PROBE(open_entry, path, fi->flags);
+
+	result = is_virtual_path(path) ? vfs_open(path, fi) : my_open(path, fi);
+
+	stats_op(OP_OPEN, &start, result);
+
+	if (!is_virtual_path(path))
 	{
-		result = -ENOENT;
+		record_op(RECORD_OPEN, path, &start, 0, 0, result);
 	}
 
+	MY_PROBE(open_return, path, result);
+
 	return result;
 }
 
-/**
- * Returns list of all files in the specified directory. The only supported
- * directory path is "/"
- *
- * TODO: If path is correct but points to a file, return -ENOTDIR instead of
- * 	-ENOENT
- */
-static int my_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-	off_t offset, struct fuse_file_info *fi)
+static int op_read(const char *path, char *buf, size_t size, off_t offset,
+	struct fuse_file_info *fi)
 {
-	char *query;
-	MYSQL_RES *res;
-	MYSQL_ROW row;
+	struct timespec start;
 	int result;
 
-	//
-	// Make sure that the only directory ("/") was requested
-	//
+	if (is_virtual_path(path))
+	{
+		return vfs_read(buf, size, offset, fi);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	MY_PROBE(read_entry, path, size, offset);
 
-	if (strcmp(path, "/") != 0)
+	result = my_read(path, buf, size, offset, fi);
+
+	stats_op(OP_READ, &start, result);
+	record_op(RECORD_READ, path, &start, offset, size, result);
+
+	MY_PROBE(read_return, path, result);
+
+	return result;
+}
+
+static int op_getxattr(const char *path, const char *name, char *value, size_t size)
+{
+	struct timespec start;
+	int result;
+
+	if (is_virtual_path(path))
 	{
-		return -ENOENT;
+		return -ENODATA;
 	}
 
-	//
-	// Add two virtual directories: "." and ".."
-	//
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-	filler(buf, ".", NULL, 0);
-	filler(buf, "..", NULL, 0);
+	MY_PROBE(getxattr_entry, path, name, size);
+
+	result = my_getxattr(path, name, value, size);
+
+	stats_op(OP_GETXATTR, &start, result == -ENODATA ? 0 : result);
+	record_op(RECORD_GETXATTR, path, &start, record_xattr_index(name), size, result);
+
+	MY_PROBE(getxattr_return, path, result);
+
+	return result;
+}
+
+static int op_listxattr(const char *path, char *list, size_t size)
+{
+	struct timespec start;
+	int result;
+
+	if (is_virtual_path(path))
+	{
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	MY_PROBE(listxattr_entry, path, size);
+
+	result = my_listxattr(path, list, size);
+
+	stats_op(OP_LISTXATTR, &start, result);
+	record_op(RECORD_LISTXATTR, path, &start, 0, size, result);
+
+	MY_PROBE(listxattr_return, path, result);
 
+	return result;
+}
+
+static int op_write(const char *path, const char *buf, size_t size, off_t offset,
+	struct fuse_file_info *fi)
+{
+	return is_virtual_path(path) ? vfs_write(buf, size, fi) : -EROFS;
+}
+
+static int op_truncate(const char *path, off_t size)
+{
 	//
-	// Query list of files from the database
+	// Shell redirections truncate the control file before writing to it
 	//
 
-	query = (char*) malloc(strlen(readdir_qp) + strlen(my_name_field) + 
-		strlen(my_table) + strlen(my_name_field));
+	return strcmp(path, VFS_CONTROL) == 0 ? 0 : -EROFS;
+}
+
+static int op_flush(const char *path, struct fuse_file_info *fi)
+{
+	return is_virtual_path(path) ? vfs_flush(fi) : 0;
+}
+
+static int op_release(const char *path, struct fuse_file_info *fi)
+{
+	struct vfs_file *file = (struct vfs_file*) (uintptr_t) fi->fh;
 
-	if (query != NULL)
+	if (is_virtual_path(path) && file != NULL)
 	{
-		sprintf(query, readdir_qp, my_name_field, my_table, my_name_field);
-		mysql_real_query(&mysql, query, (unsigned int) strlen(query));
-		res = mysql_use_result(&mysql);
+		free(file->text);
+		free(file);
+		fi->fh = 0;
+	}
 
-		if (res != NULL)
-		{
-			while (row = mysql_fetch_row(res))
-			{
-				filler(buf, row[0], NULL, 0);
-			}
+	return 0;
+}
 
-			mysql_free_result(res);
+/**
+ * Starts background threads once FUSE has daemonized
+ */
+static void *my_init(struct fuse_conn_info *conn)
+{
+	pthread_t thread;
+	int sock;
 
-			result = 0;
-		}
-		else
+	if (pthread_create(&thread, NULL, watchdog_run, NULL) == 0)
+	{
+		pthread_detach(thread);
+	}
+
+	if (my_metrics_socket != NULL)
+	{
+		sock = metrics_listen(my_metrics_socket);
+
+		if (sock >= 0 && pthread_create(&thread, NULL, metrics_serve, (void*) (intptr_t) sock) == 0)
 		{
-			result = -ENOENT;
+			pthread_detach(thread);
 		}
+	}
 
-		free(query);
+	if (my_metrics_file != NULL && pthread_create(&thread, NULL, metrics_dump, NULL) == 0)
+	{
+		pthread_detach(thread);
 	}
-	else
+
+	if (trace_file != NULL && pthread_create(&thread, NULL, trace_write, NULL) == 0)
 	{
-		result = -ENOMEM;
+		pthread_detach(thread);
 	}
 
-	return result;
-} 
+	if (record_file != NULL && pthread_create(&thread, NULL, record_write, NULL) == 0)
+	{
+		pthread_detach(thread);
+	}
+
+	//
+	// One stripe worker per connection reads may use, more would only wait
+	// for one
+	//
+
+	if (my_stripe_size > 0 && my_stripes > 1)
+	{
+		stripe_start(pool_count * (pool_size - pool_reserved));
+	}
+
+	return NULL;
+}
 
 /**
- * Allows to open directory "/" and files inside it, which have corresponding
- * rows
+ * Stops background threads that use MySQL client state before unmounting
  */
-static int my_open(const char* path, struct fuse_file_info *fi)
+static void my_destroy(void *private_data)
 {
-	char *query, *filename;
-	int result;
-	MYSQL_RES *res;
-	MYSQL_ROW row;
+	stripe_stop();
+}
+
+/**
+ * Operations implemented by MyBLOBFS
+ */
+static struct fuse_operations my_oper =
+{
+	.getattr = op_getattr,
+	.readdir = op_readdir,
+	.open    = op_open,
+	.read    = op_read,
+	.getxattr = op_getxattr,
+	.listxattr = op_listxattr,
+	.write   = op_write,
+	.truncate = op_truncate,
+	.flush   = op_flush,
+	.release = op_release,
+	.init    = my_init,
+	.destroy = my_destroy
+};
+
+/**
+ * Splits the data field of table t into data fields separated by pluses, if
+ * it has several. Returns if it succeeded
+ */
+static my_bool table_columns(struct my_table *t)
+{
+	char *spec, *field, *save;
+	unsigned int n;
+
+	t->columns[0] = t->data_field;
+	t->column_count = 1;
+
+	if (strchr(t->data_field, '+') == NULL)
+	{
+		return 1;
+	}
 
 	//
-	// Check for path validity and disallow write requests
+	// Data field may be shared by several tables, split a copy of it
 	//
 
-	if (!is_valid_path(path))
+	if ((spec = strdup(t->data_field)) == NULL)
 	{
-		return -ENOENT;
+		return 0;
 	}
 
-	if (fi->flags & O_RDONLY == 0)
+	n = 0;
+
+	for (field = strtok_r(spec, "+", &save); field != NULL; field = strtok_r(NULL, "+", &save))
 	{
-		return -EROFS;
+		if (n == COLUMNS_MAX)
+		{
+			return 0;
+		}
+
+		t->columns[n++] = field;
 	}
 
-	//
-	// Path points to the only directory, allow to open it
-	//
+	if (n == 0)
+	{
+		return 0;
+	}
 
-	if (strcmp(path, "/") == 0)
+	t->column_count = n;
+	t->data_field = t->columns[0];
+
+	return 1;
+}
+
+/**
+ * Splits the name field of table t into the fields of its key, if it is a
+ * composite one: key fields separated by slashes, the last of them naming
+ * the files, and its data field with table_columns(). Returns if it
+ * succeeded
+ */
+static my_bool table_fields(struct my_table *t)
+{
+	char *spec, *field, *save;
+	unsigned int n;
+
+	t->fields[0] = t->name_field;
+	t->levels = 0;
+
+	if (!table_columns(t))
 	{
 		return 0;
 	}
 
+	if (strchr(t->name_field, '/') == NULL)
+	{
+		return 1;
+	}
+
 	//
-	// Query if file exists in the database
+	// Name field may be shared by several tables, split a copy of it
 	//
 
-	filename = (char*) malloc(strlen(path) + 1);
-	if (filename != NULL)
+	if ((spec = strdup(t->name_field)) == NULL)
 	{
-		strcpy(filename, path + 1);
+		return 0;
+	}
 
-		query = (char*) malloc(strlen(read_qp) + 1 + strlen(my_table) +
-			strlen(my_name_field) + strlen(filename));
+	n = 0;
 
-		if (query != NULL)
+	for (field = strtok_r(spec, "/", &save); field != NULL; field = strtok_r(NULL, "/", &save))
+	{
+		if (n == KEY_FIELDS_MAX)
 		{
-			sprintf(query, read_qp, "1", my_table, my_name_field, filename);
-			mysql_real_query(&mysql, query, (unsigned int) strlen(query));
-			res = mysql_use_result(&mysql);
+			return 0;
+		}
 
-			if (res != NULL)
-			{
+		t->fields[n++] = field;
+	}
 
-				//
-				// Return if file exists
-				//
+	if (n == 0)
+	{
+		return 0;
+	}
 
-				row = mysql_fetch_row(res);
+	t->levels = n - 1;
+	t->name_field = t->fields[t->levels];
 
-				if (row == NULL)
-				{
-					result = -ENOENT;
-				}
-				else
+	return 1;
+}
+
+/**
+ * Reads the views defined in file, one per line as "name condition", or
+ * "table/name condition" if tables are mounted as subdirectories. Empty lines
+ * and lines starting with "#" are skipped. Returns if it succeeded, after
+ * printing the offending line otherwise
+ */
+static my_bool views_load(const char *file)
+{
+	FILE *f;
+	char line[4096], *name, *condition, *slash;
+	struct my_view *v;
+	unsigned int i, n;
+	my_bool valid;
+	size_t len;
+
+	if ((f = fopen(file, "r")) == NULL)
+	{
+		printf("Error: Unable to open views file \"%s\"\n", file);
+		return 0;
+	}
+
+	valid = 1;
+
+	for (n = 1; fgets(line, sizeof(line), f) != NULL; n++)
+	{
+		valid = 0;
+		len = strlen(line);
+
+		if (len > 0 && line[len - 1] == '\n')
+		{
+			line[--len] = '\0';
+		}
+		else if (!feof(f))
+		{
+			break;
+		}
+
+		name = line + strspn(line, " \t");
+
+		if (*name == '\0' || *name == '#')
+		{
+			valid = 1;
+			continue;
+		}
+
+		condition = name + strcspn(name, " \t");
+
+		if (*condition == '\0' || my_view_count == VIEWS_MAX)
+		{
+			break;
+		}
+
+		*condition++ = '\0';
+		condition += strspn(condition, " \t");
+
+		//
+		// Statements are pipelined, a condition must not end one
+		//
+
+		if (*condition == '\0' || strchr(condition, ';') != NULL)
+		{
+			break;
+		}
+
+		v = &my_views[my_view_count];
+		v->table = my_table_dirs ? NULL : &my_tables[0];
+
+		if (my_table_dirs && (slash = strchr(name, '/')) != NULL)
+		{
+			*slash = '\0';
+
+			for (i = 0; i < my_table_count; i++)
+			{
+				if (strcmp(my_tables[i].table, name) == 0)
 				{
-					result = 0;
+					v->table = &my_tables[i];
 				}
+			}
+
+			name = slash + 1;
+		}
+
+		if (v->table == NULL || v->table->levels > 0 || *name == '\0' ||
+			strchr(name, '/') != NULL || strlen(name) > NAME_MAX)
+		{
+			break;
+		}
+
+		for (i = 0; i < my_view_count; i++)
+		{
+			if (my_views[i].table == v->table && strcmp(my_views[i].name, name) == 0)
+			{
+				break;
+			}
+		}
+
+		if (i < my_view_count)
+		{
+			break;
+		}
+
+		v->name = strdup(name);
+		v->condition = strdup(condition);
+
+		if (v->name == NULL || v->condition == NULL)
+		{
+			break;
+		}
+
+		my_view_count++;
+		valid = 1;
+	}
+
+	if (!valid)
+	{
+		printf("Error: Invalid view in \"%s\", line %u\n", file, n);
+		fclose(f);
+		return 0;
+	}
+
+	fclose(f);
+
+	return 1;
+}
+
+/**
+ * Checks the condition of every view on the server, with a query that
+ * returns no rows. Returns if all of them are valid, after printing the
+ * error of the first one that is not otherwise
+ */
+static my_bool views_check(MYSQL *mysql)
+{
+	MYSQL_RES *res;
+	char *query;
+	unsigned int i;
 
-				mysql_free_result(res);
-			}
-			else
-			{
-				result = -EAGAIN;
-			}
+	for (i = 0; i < my_view_count; i++)
+	{
+		query = (char*) malloc(strlen(my_views[i].table->table) +
+			strlen(my_views[i].condition) + 40);
+
+		if (query == NULL)
+		{
+			puts("Out of memory");
+			return 0;
+		}
 
+		sprintf(query, "SELECT 1 FROM %s WHERE (%s) LIMIT 0",
+			my_views[i].table->table, my_views[i].condition);
+
+		if (mysql_query(mysql, query) != 0)
+		{
+			printf("Error: Invalid condition of view \"%s\": %s\n", my_views[i].name,
+				mysql_error(mysql));
 			free(query);
+			return 0;
 		}
-		else
+
+		free(query);
+
+		if ((res = mysql_store_result(mysql)) != NULL)
 		{
-			result = -ENOMEM;
+			mysql_free_result(res);
 		}
-	
-		free(filename);
-	}
-	else
-	{
-		result = -ENOMEM;
 	}
 
-	return result;
+	return 1;
 }
 
 /**
- * Returns size bytes from the file identified by path, starting from byte offset 
- *
- * TODO: chop the desired block of data using SQL, rather than on the client side
+ * Sets up the mounted tables: table alone as the root directory or, if list
+ * is given, every table of it as a subdirectory. List is comma-separated
+ * table[:name_field[:data_field]], with fields defaulting to name_field and
+ * data_field. Returns if it succeeded
  */
-static int my_read(const char *path, char *buf, size_t size, off_t offset,
-  struct fuse_file_info *fi)
+static my_bool tables_init(char *table, char *list, char *name_field, char *data_field)
 {
-	char *query, *filename;
-	unsigned long *lengths, len;
-	MYSQL_RES *res;
-	MYSQL_ROW row;
+	struct my_table *t;
+	char *spec, *colon, *save;
 
-	//
-	// Check if path is valid and points to a file
-	//
-
-	if (!is_valid_path(path))
-	{
-		return -ENOENT;
-	}
-
-	if (strcmp(path, "/") == 0)
+	if (list == NULL)
 	{
-		return -EISDIR;
+		my_tables[0].table = table;
+		my_tables[0].name_field = name_field;
+		my_tables[0].data_field = data_field;
+		my_table_count = 1;
+		return table_fields(&my_tables[0]);
 	}
 
-	//
-	// Query file content from the database
-	//
+	my_table_dirs = 1;
 
-	filename = (char*) malloc(strlen(path));
-	if (filename != NULL)
+	for (spec = strtok_r(list, ",", &save); spec != NULL; spec = strtok_r(NULL, ",", &save))
 	{
-		strcpy(filename, path + 1);
-
-		query = (char*) malloc(strlen(read_qp) + strlen(my_data_field) +
-			strlen(my_table) + strlen(my_name_field) + strlen(filename) + 1);
-
-		if (query != NULL)
+		if (my_table_count == TABLES_MAX)
 		{
-			sprintf(query, read_qp, my_data_field, my_table, my_name_field, filename);
-			mysql_real_query(&mysql, query, (unsigned int) strlen(query));
-			res = mysql_use_result(&mysql);
-
-			if (res != NULL)
-			{
-				//
-				// Copy part of the file, specified by offset and size
-				//
+			return 0;
+		}
 
-				row = mysql_fetch_row(res);
-				if (row != NULL)
-				{
-			 		lengths = mysql_fetch_lengths(res);
-					len = lengths[0];
+		t = &my_tables[my_table_count++];
+		t->table = spec;
+		t->name_field = name_field;
+		t->data_field = data_field;
 
-					if (offset <= len)
-					{
-						if (offset + size > len)
-						{
-							size = len - offset;
-						}
+		if ((colon = strchr(spec, ':')) != NULL)
+		{
+			*colon = '\0';
+			t->name_field = colon + 1;
 
-						memcpy(buf, row[0] + offset, size);
-					}
-					else
-					{
-						size = 0;
-					}
-				}
-				else
-				{
-					size = -ENOENT;
-				}
-		
-				mysql_free_result(res);
-			}
-			else
+			if ((colon = strchr(colon + 1, ':')) != NULL)
 			{
-				size = -ENOMEM;
+				*colon = '\0';
+				t->data_field = colon + 1;
 			}
-			
-			free(query);
 		}
-		else
+
+		if (strlen(t->table) > NAME_MAX || !table_fields(t))
 		{
-			size = -ENOMEM;
+			return 0;
 		}
-	
-		free(filename);
-	}
-	else
-	{
-		size = -ENOMEM;
+
+		sprintf(t->prefix, "%s/", t->table);
 	}
 
-	return size;
+	return my_table_count > 0;
 }
 
-/**
- * Operations implemented by MyBLOBFS
- */
-static struct fuse_operations my_oper =
-{
-	.getattr = my_getattr,
-	.readdir = my_readdir,
-	.open    = my_open,
-	.read    = my_read
-};
-
 /**
  * Program entry point
  *
@@ -610,7 +7959,12 @@ int main(int argc, char *argv[])
 {
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 	struct options opts;
-	char *password = NULL;
+	char *password = NULL, *replica, *field;
+	struct my_conn *conn;
+	struct sigaction sa;
+	struct record_header header;
+	struct timeval now;
+	unsigned int i, j;
 	int ret, res, error;
 
 	//
@@ -619,6 +7973,19 @@ int main(int argc, char *argv[])
 
 	memset(&opts, 0, sizeof(struct options));
 
+	opts.prefetch_max_size = 65536;
+	opts.cache_size = 64;
+	opts.cache_ttl = 1;
+	opts.pool_size = 4;
+	opts.reserved = 1;
+	opts.stripe_size = 4194304;
+	opts.stripes = 4;
+	opts.timeout_prefetch = 10000;
+	opts.metrics_interval = 15;
+	opts.trace_sample = 1;
+	opts.shard_digits = 2;
+	opts.shard_width = 10;
+
 	if (fuse_opt_parse(&args, &opts, hello_opts, NULL) == -1)
 	{
 		return 0;
@@ -626,127 +7993,419 @@ int main(int argc, char *argv[])
 
 	if (opts.database != NULL)
 	{
-		if (opts.table != NULL)
+		if (opts.table != NULL || opts.tables != NULL)
 		{
 			if (opts.name_field != NULL)
 			{
 				if (opts.data_field != NULL)
 				{
-					my_table = (char*) malloc(strlen(opts.table) + 1);
-					if (my_table != NULL)
+					if (tables_init(opts.table, opts.tables, opts.name_field, opts.data_field))
 					{
-						my_name_field = (char*) malloc(strlen(opts.name_field) + 1);
-						if (my_name_field != NULL)
+						if (opts.port == 0)
 						{
-							my_data_field = (char*) malloc(strlen(opts.data_field) + 1);
-							if (my_data_field != NULL)
+							opts.port = 3306; // FIXME
+						}
+
+						//
+						// Read password from command line, if -p flag was specifed
+						//
+
+						if (opts.rq_password)
+						{
+							password = getpass("Enter password: ");
+						}
+
+						if (!opts.rq_password || password != NULL)
+						{
+							//
+							// Copy command-line option values to global variables
+							//
+
+							my_prefetch = opts.prefetch;
+							my_prefetch_max_size = opts.prefetch_max_size;
+							cache_budget = (unsigned long) opts.cache_size << 20;
+							cache_ttl = opts.cache_ttl;
+							my_stripe_size = opts.stripe_size;
+							my_stripes = opts.stripes;
+
+							my_shard_levels = opts.shard_levels;
+							my_shard_digits = opts.shard_digits;
+							my_shard_width = opts.shard_width;
+							my_partition_size = opts.partition_size;
+							my_string_keys = opts.string_keys;
+
+							sched_timeouts[MY_CLASS_META] = opts.timeout_meta;
+							sched_timeouts[MY_CLASS_READ] = opts.timeout_read;
+							sched_timeouts[MY_CLASS_PREFETCH] = opts.timeout_prefetch;
+
+							my_metrics_socket = opts.metrics_socket;
+							my_metrics_file = opts.metrics_file;
+							my_metrics_interval = opts.metrics_interval ? opts.metrics_interval : 1;
+
+							//
+							// Set up the connection pool: the primary server
+							// first, followed by its read replicas, or every
+							// server rows are split across
+							//
+
+							my_username = opts.username;
+							my_password = password;
+							my_database = opts.database;
+							pool_size = opts.pool_size ? opts.pool_size : 1;
+							pool_reserved = opts.reserved < pool_size ? opts.reserved : pool_size - 1;
+
+							error = 0;
+							my_server_count = 0;
+
+							if (opts.servers != NULL)
 							{
-								if (opts.port == 0)
+								for (replica = strtok(opts.servers, ","); replica != NULL;
+									replica = strtok(NULL, ","))
 								{
-									opts.port = 3306; // FIXME
+									if (!pool_add_endpoint(replica, opts.port, my_server_count++))
+									{
+										printf("Error: Invalid server \"%s\"\n", replica);
+										error = 1;
+									}
 								}
+							}
+							else
+							{
+								pool_add_endpoint(opts.hostname, opts.port, my_server_count++);
+							}
 
-								//
-								// Read password from command line, if -p flag was specifed
-								//
+							if (my_server_count == 0)
+							{
+								puts("Error: No servers given");
+								error = 1;
+							}
+
+							if (my_server_count > 1 && opts.replicas != NULL)
+							{
+								puts("Error: Servers rows are split across cannot have replicas");
+								error = 1;
+							}
 
-								if (opts.rq_password)
+							if (opts.replicas != NULL)
+							{
+								for (replica = strtok(opts.replicas, ","); replica != NULL;
+									replica = strtok(NULL, ","))
 								{
-									password = getpass("Enter password: ");
+									if (!pool_add_endpoint(replica, opts.port, 0))
+									{
+										printf("Error: Invalid replica \"%s\"\n", replica);
+										error = 1;
+									}
 								}
+							}
 
-								if (!opts.rq_password || password != NULL)
-								{
-									//
-									// Copy command-line option values to global variables
-									//
+							//
+							// Rows are split by hash unless bounds of the
+							// name ranges of the servers are given
+							//
 
-									strcpy(my_table, opts.table);
-									strcpy(my_name_field, opts.name_field);
-									strcpy(my_data_field, opts.data_field);
+							if (opts.server_bounds != NULL && !error)
+							{
+								my_server_ranges = 1;
+								j = 0;
 
-									//
-									// Try to connect to MySQL database
-									//
+								for (field = strtok(opts.server_bounds, ","); field != NULL && !error;
+									field = strtok(NULL, ","))
+								{
+									if (j + 1 >= my_server_count || !is_uint(field))
+									{
+										error = 1;
+										break;
+									}
+
+									my_server_bounds[j] = strtoull(field, NULL, 10);
 
-									mysql_init(&mysql);
-									if (mysql_real_connect(&mysql, opts.hostname, 
-										opts.username, password, opts.database, opts.port,
-										NULL, 0) != NULL)
+									if (j > 0 && my_server_bounds[j] <= my_server_bounds[j - 1])
 									{
-										if (!is_valid_ident(my_table))
-										{
-											puts("Error: Illegal characters in table name identifier");
-											error = 1;
-										}
+										error = 1;
+									}
+
+									j++;
+								}
 
-										//
-										// Verify table and field names validity
-										//
+								if (error || j + 1 != my_server_count || my_string_keys)
+								{
+									puts("Error: Server bounds need integer names, one less than servers, ascending");
+									error = 1;
+								}
+							}
+
+							//
+							// Try to connect to MySQL database
+							//
+
+							conn = error ? NULL : pool_connect(&pool_endpoints[0]);
+							if (conn != NULL)
+							{
+								pool_endpoints[0].idle = conn;
+								pool_endpoints[0].open = 1;
+
+								//
+								// Verify table and field names validity
+								//
 
-										error = 0;
+								for (i = 0; i < my_table_count; i++)
+								{
+									if (!is_valid_ident(my_tables[i].table))
+									{
+										puts("Error: Illegal characters in table name identifier");
+										error = 1;
+									}
 
-										if (!is_valid_ident(my_table))
+									for (j = 0; j <= my_tables[i].levels; j++)
+									{
+										if (!is_valid_ident(my_tables[i].fields[j]))
 										{
-											puts("Error: Illegal characters in table name identifier");
+											puts("Error: Illegal characters in ""name"" field identifier");
 											error = 1;
 										}
+									}
+
+									if (my_tables[i].levels > 0 && (my_shard_levels > 0 ||
+										my_partition_size > 0 || opts.record != NULL))
+									{
+										puts("Error: Sharding, partitions and recordings need a single name field");
+										error = 1;
+									}
 
-										if (!is_valid_ident(my_name_field))
+									for (j = 0; j < my_tables[i].column_count; j++)
+									{
+										if (!is_valid_ident(my_tables[i].columns[j]))
 										{
-											puts("Error: Illegal characters in ""name"" field identifier");
+											puts("Error: Illegal characters in ""data"" field identifier");
 											error = 1;
 										}
+									}
+
+									if (my_tables[i].levels > 0 && my_server_count > 1)
+									{
+										puts("Error: Splitting rows across servers needs a single name field");
+										error = 1;
+									}
+
+									if (my_tables[i].column_count > 1 && opts.record != NULL)
+									{
+										puts("Error: Recordings need a single data field");
+										error = 1;
+									}
+								}
+
+								//
+								// Split fields exposed as extended attributes
+								//
 
-										if (!is_valid_ident(my_data_field))
+								if (opts.xattr_fields != NULL)
+								{
+									for (field = strtok(opts.xattr_fields, "+"); field != NULL;
+										field = strtok(NULL, "+"))
+									{
+										if (my_xattr_count == XATTRS_MAX || !is_valid_ident(field) ||
+											(my_xattr_names[my_xattr_count] = (char*) malloc(
+											strlen(XATTR_PREFIX) + strlen(field) + 1)) == NULL)
 										{
-											puts("Error: Illegal characters in ""data"" field identifier");
+											puts("Error: Invalid extended attribute fields");
 											error = 1;
+											break;
 										}
 
-										if (!error)
+										sprintf(my_xattr_names[my_xattr_count], "%s%s", XATTR_PREFIX, field);
+										my_xattr_fields[my_xattr_count++] = field;
+									}
+								}
+
+								//
+								// Content checksums are computed by the server,
+								// or read from a field like other attributes
+								//
+
+								if (opts.checksum != NULL || opts.checksum_field != NULL)
+								{
+									for (i = 0; checksum_algorithms[i].name != NULL; i++)
+									{
+										if (strcmp(checksum_algorithms[i].name,
+											opts.checksum != NULL ? opts.checksum : "sha256") == 0)
 										{
-											//
-											// Give control to FUSE library
-											//
-
-											ret = fuse_main(args.argc, args.argv, &my_oper);
-											if (ret)
-											{
-												puts("");
-											}
+											break;
 										}
 									}
+
+									my_checksum_xattr = opts.checksum_xattr;
+
+									if (my_checksum_xattr == NULL && checksum_algorithms[i].name != NULL &&
+										(my_checksum_xattr = (char*) malloc(strlen(CHECKSUM_XATTR_PREFIX) +
+										strlen(checksum_algorithms[i].name) + 1)) != NULL)
+									{
+										sprintf(my_checksum_xattr, "%s%s", CHECKSUM_XATTR_PREFIX,
+											checksum_algorithms[i].name);
+									}
+
+									if (checksum_algorithms[i].name == NULL || my_checksum_xattr == NULL)
+									{
+										puts("Error: Invalid checksum algorithm");
+										error = 1;
+									}
+									else if (opts.checksum_field == NULL)
+									{
+										my_checksum = &checksum_algorithms[i];
+									}
+									else if (my_xattr_count < XATTRS_MAX && is_valid_ident(opts.checksum_field))
+									{
+										my_xattr_names[my_xattr_count] = my_checksum_xattr;
+										my_xattr_fields[my_xattr_count++] = opts.checksum_field;
+									}
 									else
 									{
-										puts(mysql_error(&mysql));
+										puts("Error: Invalid checksum field");
+										error = 1;
+									}
+								}
+
+								//
+								// Verify that the shard layout fits row names
+								//
+
+								if (my_shard_levels > 0 && (my_shard_digits == 0 ||
+									my_shard_digits > 9 || my_shard_width > 19 ||
+									my_shard_levels * my_shard_digits > my_shard_width))
+								{
+									puts("Error: Invalid shard layout");
+									error = 1;
+								}
+
+								if (my_string_keys && (my_shard_levels > 0 ||
+									my_partition_size > 0 || opts.record != NULL))
+								{
+									puts("Error: Sharding, partitions and recordings need integer names");
+									error = 1;
+								}
+
+								if (my_table_dirs && opts.record != NULL)
+								{
+									puts("Error: Recordings need a single table");
+									error = 1;
+								}
+
+								if (my_partition_size > 0 && opts.record != NULL)
+								{
+									puts("Error: Recordings cannot be combined with partitions");
+									error = 1;
+								}
+
+								//
+								// Build query statements, leaving out only per-query values
+								//
+
+								for (i = 0; i < my_table_count && !error; i++)
+								{
+									if (!query_init_templates(&my_tables[i]))
+									{
+										puts("Out of memory");
+										error = 1;
+									}
+								}
+
+								//
+								// Load views and have the server check their
+								// conditions
+								//
+
+								if (!error && opts.views != NULL)
+								{
+									error = !views_load(opts.views) || !views_check(&conn->mysql);
+								}
+
+								//
+								// Open the query trace, if one was requested
+								//
+
+								trace_slow = opts.trace_slow;
+								trace_sample = opts.trace_sample;
+
+								if (!error && opts.trace_file != NULL)
+								{
+									if ((trace_file = fopen(opts.trace_file, "a")) == NULL)
+									{
+										printf("Error: Unable to open trace file \"%s\"\n", opts.trace_file);
+										error = 1;
 									}
+								}
+
+								//
+								// Start recording operations, if requested
+								//
 
-									if (password != NULL)
+								if (!error && opts.record != NULL)
+								{
+									if ((record_file = fopen(opts.record, "w")) == NULL)
+									{
+										printf("Error: Unable to open recording \"%s\"\n", opts.record);
+										error = 1;
+									}
+									else
 									{
-										free(password);
+										memset(&header, 0, sizeof(struct record_header));
+										memcpy(header.magic, RECORD_MAGIC, sizeof(header.magic));
+										header.version = RECORD_VERSION;
+										header.entry_size = sizeof(struct record_entry);
+
+										gettimeofday(&now, NULL);
+										header.started = now.tv_sec * 1000000ULL + now.tv_usec;
+										clock_gettime(CLOCK_MONOTONIC, &record_started);
+
+										fwrite(&header, sizeof(struct record_header), 1, record_file);
+										fflush(record_file);
 									}
 								}
 
-								free(my_data_field);
+								if (!error)
+								{
+									//
+									// Have FUSE signal worker threads whose requests
+									// get interrupted, so that their queries can be
+									// killed
+									//
+
+									memset(&sa, 0, sizeof(struct sigaction));
+									sa.sa_handler = my_interrupt;
+									sigemptyset(&sa.sa_mask);
+									sigaction(SIGUSR1, &sa, NULL);
+
+									fuse_opt_add_arg(&args, "-ointr");
+
+									pthread_key_create(&stats_key, stats_release);
+									pthread_key_create(&buf_key, buf_release);
+
+									//
+									// Give control to FUSE library
+									//
+
+									ret = fuse_main(args.argc, args.argv, &my_oper, NULL);
+									if (ret)
+									{
+										puts("");
+									}
+								}
 							}
-							else
+							else if (!error)
 							{
-								puts("Out of memory");
+								puts("Unable to connect to MySQL server");
 							}
 
-							free(my_name_field);
-						}
-						else
-						{
-							puts("Out of memory");
+							if (password != NULL)
+							{
+								free(password);
+							}
 						}
 
-						free(my_table);
 					}
 					else
 					{
-						puts("Out of memory");
+						puts("Error: Invalid table list");
 					}
 				}
 				else